@@ -1,4 +1,4 @@
-%module hl_vt100
+%module(threads="1") hl_vt100
 /*
  * Copyright (c) 2016 Julien Palard.
  * All rights reserved.
@@ -27,6 +27,115 @@
 %{
 #include "src/lw_terminal_vt100.h"
 #include "src/hl_vt100.h"
+#include "src/vt100_shm.h"
+
+/*
+** hl_vt100.Screen is an immutable snapshot of the grid, copied in a
+** single bytes object. It exposes the buffer protocol as a 2-D
+** (height, width) array of 'c', so memoryview() and numpy.asarray()
+** use it without copying, and screen[y] is a memoryview slice of row y.
+*/
+typedef struct
+{
+    PyObject_HEAD
+    PyObject   *data;
+    PyObject   *flat;
+    Py_ssize_t shape[2];
+    Py_ssize_t strides[2];
+} ScreenObject;
+
+static PyTypeObject Screen_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+};
+
+static void Screen_dealloc(PyObject *obj)
+{
+    ScreenObject *self = (ScreenObject *)obj;
+
+    Py_XDECREF(self->flat);
+    Py_XDECREF(self->data);
+    PyObject_Del(obj);
+}
+
+static int Screen_getbuffer(PyObject *obj, Py_buffer *view, int flags)
+{
+    ScreenObject *self = (ScreenObject *)obj;
+
+    if (PyBuffer_FillInfo(view, obj, PyBytes_AS_STRING(self->data),
+                          PyBytes_GET_SIZE(self->data), 1, flags) == -1)
+        return -1;
+    if ((flags & PyBUF_FORMAT) == PyBUF_FORMAT)
+        view->format = "c";
+    if ((flags & PyBUF_ND) == PyBUF_ND) {
+        view->ndim = 2;
+        view->shape = self->shape;
+    }
+    if ((flags & PyBUF_STRIDES) == PyBUF_STRIDES)
+        view->strides = self->strides;
+    return 0;
+}
+
+static Py_ssize_t Screen_length(PyObject *obj)
+{
+    return ((ScreenObject *)obj)->shape[0];
+}
+
+static PyObject *Screen_item(PyObject *obj, Py_ssize_t y)
+{
+    ScreenObject *self = (ScreenObject *)obj;
+
+    if (y < 0 || y >= self->shape[0]) {
+        PyErr_SetString(PyExc_IndexError, "row out of range");
+        return NULL;
+    }
+    return PySequence_GetSlice(self->flat, y * self->shape[1],
+                               (y + 1) * self->shape[1]);
+}
+
+static PySequenceMethods Screen_as_sequence;
+static PyBufferProcs Screen_as_buffer;
+
+static PyObject *hl_vt100_screen(struct lw_terminal_vt100 *vt100)
+{
+    ScreenObject *self;
+    unsigned int width;
+
+    if (!(Screen_Type.tp_flags & Py_TPFLAGS_READY)) {
+        Screen_as_sequence.sq_length = Screen_length;
+        Screen_as_sequence.sq_item = Screen_item;
+        Screen_as_buffer.bf_getbuffer = Screen_getbuffer;
+        Screen_Type.tp_name = "hl_vt100.Screen";
+        Screen_Type.tp_basicsize = sizeof(ScreenObject);
+        Screen_Type.tp_dealloc = Screen_dealloc;
+        Screen_Type.tp_as_sequence = &Screen_as_sequence;
+        Screen_Type.tp_as_buffer = &Screen_as_buffer;
+        Screen_Type.tp_flags = Py_TPFLAGS_DEFAULT;
+        Screen_Type.tp_doc = "Immutable (height, width) snapshot of a vt100 screen";
+        if (PyType_Ready(&Screen_Type) < 0)
+            return NULL;
+    }
+    self = PyObject_New(ScreenObject, &Screen_Type);
+    if (self == NULL)
+        return NULL;
+    self->flat = NULL;
+    self->data = PyBytes_FromStringAndSize(NULL, 132 * vt100->height);
+    if (self->data == NULL)
+        goto fail;
+    width = lw_terminal_vt100_copy_screen(vt100, PyBytes_AS_STRING(self->data));
+    if (_PyBytes_Resize(&self->data, width * vt100->height) == -1)
+        goto fail;
+    self->flat = PyMemoryView_FromObject(self->data);
+    if (self->flat == NULL)
+        goto fail;
+    self->shape[0] = vt100->height;
+    self->shape[1] = width;
+    self->strides[0] = width;
+    self->strides[1] = 1;
+    return (PyObject *)self;
+fail:
+    Py_DECREF(self);
+    return NULL;
+}
 %}
 
 %typemap(in) char ** {
@@ -37,8 +146,10 @@
         $1 = (char **) malloc((size+1)*sizeof(char *));
         for (i = 0; i < size; i++) {
             PyObject *o = PyList_GetItem($input,i);
-            if (PyString_Check(o))
-                $1[i] = PyString_AsString(PyList_GetItem($input,i));
+            if (PyUnicode_Check(o))
+                $1[i] = (char *)PyUnicode_AsUTF8(o);
+            else if (PyBytes_Check(o))
+                $1[i] = PyBytes_AsString(o);
             else {
                 PyErr_SetString(PyExc_TypeError,"list must contain strings");
                 free($1);
@@ -53,12 +164,12 @@
  }
 
 %typemap(out) char ** {
-    /* Check if is a list */
+    /* One str per row, bytes are decoded 1:1 as latin-1 */
     int i;
 
-    $result = PyList_New(0);
+    $result = PyList_New(arg1->term->height);
     for (i = 0; i < arg1->term->height; i++)
-        PyList_Append($result, PyString_FromStringAndSize($1[i], arg1->term->width));
+        PyList_SET_ITEM($result, i, PyUnicode_DecodeLatin1($1[i], arg1->term->width, NULL));
  }
 
 
@@ -67,19 +178,181 @@
     free((char *) $1);
  }
 
+/* feed() takes bytes, which stay alive and unchanged during the call */
+%typemap(in) (const char *buffer, size_t len) {
+    char *buffer;
+    Py_ssize_t len;
+
+    if (PyBytes_AsStringAndSize($input, &buffer, &len) == -1)
+        return NULL;
+    $1 = buffer;
+    $2 = len;
+ }
+
+/* screen() and scrollback_line() build Python objects, they must hold the GIL */
+%feature("nothread") vt100_headless::screen;
+%feature("nothread") vt100_headless::scrollback_line;
+
 struct vt100_headless
 {
     void (*changed)(struct vt100_headless *this);
+    int detached;
+    unsigned long hibernate_after_usec;
 %immutable;
     int master;
+    int child;
+    int child_exited;
+    int exit_status;
+    int pidfd;
+    int record_error;
+    unsigned int id;
     struct termios backup;
     struct lw_terminal_vt100 *term;
     %extend {
         vt100_headless();
         ~vt100_headless();
         void fork(const char *progname, char **argv);
+        int spawn(const char *progname, char **argv);
+        int pipeline_start(size_t ring_size);
+        void pipeline_stop();
         char **getlines();
+        PyObject *screen() {
+            return hl_vt100_screen($self->term);
+        }
         int main_loop();
+        int resize(unsigned int width, unsigned int height);
+        int pump();
+        int fd() {
+            return vt100_headless_fd($self);
+        }
+        int reap(int block);
+        void feed(const char *buffer, size_t len);
+        int write(const char *buffer, size_t len) {
+            return vt100_headless_write($self, buffer, len);
+        }
+        unsigned int generation() {
+            lw_terminal_vt100_flush($self->term);
+            return $self->term->generation;
+        }
+        void lazy(size_t budget) {
+            lw_terminal_vt100_lazy($self->term, budget);
+        }
         void stop();
+        int hibernate() {
+            return lw_terminal_vt100_hibernate($self->term);
+        }
+        int record(const char *path);
+        int scrollback(const char *path);
+        int capture(int fd, int zero_copy);
+        unsigned long scrollback_lines() {
+            return $self->scrollback == NULL ? 0 : $self->scrollback->lines;
+        }
+        PyObject *scrollback_line(unsigned long n) {
+            const char *line;
+            size_t len;
+
+            line = $self->scrollback == NULL ? NULL
+                : vt100_scrollback_line($self->scrollback, n, &len);
+            if (line == NULL)
+                Py_RETURN_NONE;
+            return PyBytes_FromStringAndSize(line, len);
+        }
+        int publish(const char *name) {
+            return vt100_shm_publish($self->term, name);
+        }
+        int expect(int timeout_ms);
+        int expect_stream(const char *literal) {
+            return vt100_headless_expect_add($self, literal, strlen(literal),
+                                             VT100_EXPECT_STREAM, NULL, NULL);
+        }
+        int expect_screen(const char *regex) {
+            return vt100_headless_expect_add($self, regex, strlen(regex),
+                                             VT100_EXPECT_SCREEN | VT100_EXPECT_REGEX,
+                                             NULL, NULL);
+        }
+        void expect_remove(int id) {
+            vt100_headless_expect_remove($self, id);
+        }
     }
 };
+
+int vt100_metrics_serve(const char *path);
+int vt100_metrics_write_file(const char *path, unsigned int interval);
+
+%pythoncode %{
+import asyncio
+
+
+async def drive(vt100, changed=None, executor=None):
+    """Runs a forked vt100_headless on the running asyncio loop.
+
+    vt100.fd() (the master, or the pipeline's eventfd once
+    pipeline_start() was called) is registered with the loop, and each
+    time it is readable pump() reads and parses what is available in
+    native code with the GIL released, on executor (the loop's default
+    one if None), so thousands of sessions can share one loop without
+    parsing stalling it. changed(vt100) is called, on the loop, after
+    reads that changed the screen.
+    Fork with vt100.detached = True so fd 0 is left alone.
+    Returns the child's exit status as reported by waitpid.
+    """
+    loop = asyncio.get_running_loop()
+    done = loop.create_future()
+    watched = None
+
+    def finish():
+        if not done.done():
+            done.set_result(vt100.exit_status)
+
+    def child_exited():
+        if vt100.reap(0):
+            loop.remove_reader(vt100.pidfd)
+            finish()
+
+    def poll_exit():
+        # Without a pidfd, nothing tells when the child exits
+        if vt100.reap(0):
+            finish()
+        else:
+            loop.call_later(0.01, poll_exit)
+
+    def watch():
+        nonlocal watched
+        watched = vt100.fd()
+        loop.add_reader(watched, readable)
+
+    def pump():
+        # generation() parses what a lazy session left pending, which
+        # has to stay off the loop too
+        if changed is None:
+            return vt100.pump(), False
+        generation = vt100.generation()
+        parsed = vt100.pump()
+        return parsed, vt100.generation() != generation
+
+    def pumped(future):
+        if future.exception() is not None:
+            if not done.done():
+                done.set_exception(future.exception())
+            return
+        parsed, moved = future.result()
+        if moved:
+            changed(vt100)
+        if parsed != -1:
+            watch()
+        elif vt100.reap(0):
+            finish()
+        elif vt100.pidfd != -1:
+            loop.add_reader(vt100.pidfd, child_exited)
+        else:
+            poll_exit()
+
+    def readable():
+        # One pump at a time, the reader comes back once it is done
+        loop.remove_reader(watched)
+        future = loop.run_in_executor(executor, pump)
+        future.add_done_callback(pumped)
+
+    watch()
+    return await done
+%}
@@ -36,22 +36,88 @@ then
         echo "Failed to build python module"
         exit 1
     fi
-    cat <<EOF | python
+    cat <<EOF | python3
 import hl_vt100
 import time
 import sys
 
-print "Starting python test..."
+print("Starting python test...")
 vt100 = hl_vt100.vt100_headless()
 vt100.fork('/usr/bin/top', ['/usr/bin/top', '-n', '1'])
 vt100.main_loop()
 [sys.stdout.write(line + "\n") for line in vt100.getlines()]
+screen = vt100.screen()
+print(memoryview(screen).shape, bytes(screen[0]))
 EOF
     exit
 fi
 
 make clean
 
+# Asciicast frames with escapes are decoded out of the mapping, mixed
+# here with frames parsed in place.
+escaped_cast()
+{
+    printf '{"version": 2, "width": 80, "height": 24}\n'
+    frame=0
+    while [ $frame -lt 2000 ]
+    do
+        printf '[%d.0, "o", "plain %d\\r\\n"]\n' $frame $frame
+        printf '[%d.5, "o", "\\u001b[H\\u001b[2J\\"quoted\\" %d\\r\\n"]\n' \
+               $frame $frame
+        frame=$((frame + 1))
+    done
+}
+
+if [ "$1" = ingest ]
+then
+    make && make ingest || exit 1
+    CAST=$(mktemp)
+    escaped_cast > "$CAST"
+    OUT=$(LD_LIBRARY_PATH=. ./ingest "$CAST")
+    STATUS=$?
+    rm -f "$CAST"
+    if [ $STATUS != 0 ] || ! echo "$OUT" | grep -q '^"quoted" 1999$'
+    then
+        echo "ingest test failed"
+        exit 1
+    fi
+    echo "ingest test passed"
+    exit
+fi
+
+if [ "$1" = fuzz ]
+then
+    make && make fuzz || exit 1
+    LD_LIBRARY_PATH=. ./fuzz -r
+    exit
+fi
+
+if [ "$1" = batch ]
+then
+    make && make batch || exit 1
+    DIR=$(mktemp -d)
+    for i in 1 2 3 4 5 6 7 8
+    do
+        escaped_cast > "$DIR/$i.cast"
+        echo "$DIR/$i.cast"
+    done > "$DIR/manifest"
+    LD_LIBRARY_PATH=. ./batch -j 4 "$DIR/manifest" > /dev/null
+    STATUS=$?
+    for i in 1 2 3 4 5 6 7 8
+    do
+        grep -q '^"quoted" 1999 *$' "$DIR/$i.cast.screen" || STATUS=1
+    done
+    rm -rf "$DIR"
+    if [ $STATUS != 0 ]
+    then
+        echo "batch test failed"
+        exit 1
+    fi
+    echo "batch test passed"
+    exit
+fi
+
 if [ "$1" = c ]
 then
     make && make test
@@ -60,4 +126,7 @@ then
 fi
 
 $0 python
+$0 ingest
+$0 batch
+$0 fuzz
 $0 c
@@ -4,12 +4,22 @@
 setup.py file for hl_vt100
 """
 
-from distutils.core import setup, Extension
+from setuptools import setup, Extension
 
 
 hl_vt100_module = Extension('_hl_vt100',
                             sources=['hl_vt100_wrap.c',
                                      'src/hl_vt100.c',
+                                     'src/hl_vt100_expect.c',
+                                     'src/hl_vt100_metrics.c',
+                                     'src/hl_vt100_latency.c',
+                                     'src/hl_vt100_pipeline.c',
+                                     'src/vt100_record.c',
+                                     'src/vt100_scrollback.c',
+                                     'src/vt100_capture.c',
+                                     'src/vt100_ingest.c',
+                                     'src/vt100_encoder.c',
+                                     'src/vt100_shm.c',
                                      'src/lw_terminal_parser.c',
                                      'src/lw_terminal_vt100.c'])
 
@@ -23,7 +33,7 @@ setup(name='hl_vt100',
       py_modules=["hl_vt100"],
       classifiers=[
           "Programming Language :: C",
-          "Programming Language :: Python",
+          "Programming Language :: Python :: 3",
           "Development Status :: 5 - Production/Stable",
           "License :: OSI Approved :: BSD License",
           "Operating System :: OS Independent",
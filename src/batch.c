@@ -0,0 +1,348 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "vt100_ingest.h"
+
+/*
+** Converts many terminal logs to text on all cores.
+**
+** Usage: batch [-j WORKERS] [-o DIR] MANIFEST
+**
+** MANIFEST lists one log per line ("-" reads it from stdin). For each
+** log, LOG.txt gets the transcript (the screen right before every
+** clear screen, then the final one) and LOG.screen the final screen,
+** in DIR if given. Each worker keeps a single lw_terminal_vt100 and
+** output buffer, reset between files.
+**
+** Exits with a failure if any log could not be read or any output
+** written. Latency percentiles only cover the logs converted fine.
+*/
+
+struct worker
+{
+    pthread_t                 thread;
+    struct lw_terminal_vt100  *vt100;
+    struct vt100_ingest       ingest;
+    char                      *out;
+    size_t                    used;
+    size_t                    size;
+};
+
+static char          **paths;
+static double        *latencies;
+static unsigned long *sizes;
+static unsigned long npaths;
+static unsigned long next_path;
+static unsigned long failures;
+static const char    *output_dir;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int append(struct worker *worker, const char *data, size_t len)
+{
+    char *out;
+    size_t size;
+
+    if (worker->used + len > worker->size)
+    {
+        size = worker->size ? worker->size : 4096;
+        while (size < worker->used + len)
+            size *= 2;
+        out = realloc(worker->out, size);
+        if (out == NULL)
+            return -1;
+        worker->out = out;
+        worker->size = size;
+    }
+    memcpy(worker->out + worker->used, data, len);
+    worker->used += len;
+    return 0;
+}
+
+static void append_screen(struct worker *worker,
+                          struct lw_terminal_vt100 *vt100)
+{
+    const char **lines;
+    unsigned int y;
+    unsigned int len;
+    unsigned int height;
+
+    lines = lw_terminal_vt100_getlines(vt100);
+    for (height = vt100->height; height > 0; --height)
+    {
+        for (len = vt100->width; len > 0 && lines[height - 1][len - 1] == ' ';
+             --len)
+            ;
+        if (len > 0)
+            break ;
+    }
+    for (y = 0; y < height; ++y)
+    {
+        for (len = vt100->width; len > 0 && lines[y][len - 1] == ' '; --len)
+            ;
+        append(worker, lines[y], len);
+        append(worker, "\n", 1);
+    }
+}
+
+static void on_snapshot(struct vt100_ingest *ingest,
+                        struct lw_terminal_vt100 *vt100, int reason)
+{
+    struct worker *worker;
+
+    (void)reason;
+    worker = ingest->user_data;
+    append_screen(worker, vt100);
+    append(worker, "\f\n", 2);
+}
+
+static int write_output(struct worker *worker, const char *path,
+                        const char *extension)
+{
+    const char *base;
+    char *name;
+    ssize_t written;
+    size_t done;
+    int fd;
+
+    base = output_dir == NULL ? path : strrchr(path, '/');
+    base = base == NULL ? path : base;
+    name = malloc((output_dir ? strlen(output_dir) : 0) + strlen(base)
+                  + strlen(extension) + 2);
+    if (name == NULL)
+        return -1;
+    sprintf(name, "%s%s%s%s", output_dir ? output_dir : "",
+            output_dir && *base != '/' ? "/" : "", base, extension);
+    fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    free(name);
+    if (fd == -1)
+        return -1;
+    for (done = 0; done < worker->used; done += written)
+    {
+        written = write(fd, worker->out + done, worker->used - done);
+        if (written <= 0)
+            break ;
+    }
+    close(fd);
+    written = done == worker->used ? 0 : -1;
+    worker->used = 0;
+    return written;
+}
+
+/*
+** Failed conversions get a negative latency, left out of percentiles.
+*/
+static void convert(struct worker *worker, unsigned long i)
+{
+    double start;
+    int failed;
+
+    start = now();
+    lw_terminal_vt100_reset(worker->vt100);
+    worker->ingest.bytes = worker->ingest.frames = 0;
+    worker->used = 0;
+    failed = 0;
+    if (vt100_ingest_file(&worker->ingest, worker->vt100, paths[i]) == -1)
+    {
+        fprintf(stderr, "%s: unreadable, truncated or corrupted\n", paths[i]);
+        failed = 1;
+    }
+    if (write_output(worker, paths[i], ".txt") == -1)
+    {
+        perror(paths[i]);
+        failed = 1;
+    }
+    append_screen(worker, worker->vt100);
+    if (write_output(worker, paths[i], ".screen") == -1)
+    {
+        perror(paths[i]);
+        failed = 1;
+    }
+    if (failed)
+        __sync_fetch_and_add(&failures, 1);
+    sizes[i] = worker->ingest.bytes;
+    latencies[i] = failed ? -1 : now() - start;
+}
+
+static void *work(void *arg)
+{
+    struct worker *worker;
+    unsigned long i;
+
+    worker = arg;
+    while ((i = __sync_fetch_and_add(&next_path, 1)) < npaths)
+        convert(worker, i);
+    return NULL;
+}
+
+static int read_manifest(const char *manifest)
+{
+    FILE *file;
+    char line[4096];
+    size_t len;
+    char **grown;
+    unsigned long size;
+
+    file = strcmp(manifest, "-") == 0 ? stdin : fopen(manifest, "r");
+    if (file == NULL)
+        return -1;
+    size = 0;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (len == 0)
+            continue ;
+        if (npaths == size)
+        {
+            size = size ? size * 2 : 256;
+            grown = realloc(paths, size * sizeof(*paths));
+            if (grown == NULL)
+                return -1;
+            paths = grown;
+        }
+        paths[npaths] = malloc(len + 1);
+        if (paths[npaths] == NULL)
+            return -1;
+        memcpy(paths[npaths++], line, len + 1);
+    }
+    if (file != stdin)
+        fclose(file);
+    return 0;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x;
+    double y;
+
+    x = *(const double *)a;
+    y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(double p, unsigned long n)
+{
+    unsigned long i;
+
+    i = (unsigned long)(p * (n - 1) + 0.5);
+    return latencies[i] * 1000;
+}
+
+int main(int ac, char **av)
+{
+    struct worker *workers;
+    unsigned long nworkers;
+    unsigned long bytes;
+    unsigned long converted;
+    unsigned long i;
+    double start;
+    double seconds;
+    int opt;
+
+    nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    while ((opt = getopt(ac, av, "j:o:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'j': nworkers = strtoul(optarg, NULL, 10); break ;
+        case 'o': output_dir = optarg; break ;
+        default: goto usage;
+        }
+    }
+    if (optind != ac - 1 || nworkers == 0)
+        goto usage;
+    if (read_manifest(av[optind]) == -1)
+    {
+        perror(av[optind]);
+        return EXIT_FAILURE;
+    }
+    if (npaths == 0)
+        return EXIT_SUCCESS;
+    if (nworkers > npaths)
+        nworkers = npaths;
+    latencies = calloc(npaths, sizeof(*latencies));
+    sizes = calloc(npaths, sizeof(*sizes));
+    workers = calloc(nworkers, sizeof(*workers));
+    if (latencies == NULL || sizes == NULL || workers == NULL)
+        return EXIT_FAILURE;
+    start = now();
+    for (i = 0; i < nworkers; ++i)
+    {
+        workers[i].vt100 = lw_terminal_vt100_init(NULL, lw_terminal_parser_default_unimplemented);
+        if (workers[i].vt100 == NULL)
+            return EXIT_FAILURE;
+        workers[i].ingest.snapshot = on_snapshot;
+        workers[i].ingest.snapshot_on = VT100_SNAPSHOT_CLEAR | VT100_SNAPSHOT_END;
+        workers[i].ingest.user_data = &workers[i];
+        if (pthread_create(&workers[i].thread, NULL, work, &workers[i]) != 0)
+            return EXIT_FAILURE;
+    }
+    for (i = 0; i < nworkers; ++i)
+    {
+        pthread_join(workers[i].thread, NULL);
+        vt100_ingest_release(&workers[i].ingest);
+        lw_terminal_vt100_destroy(workers[i].vt100);
+        free(workers[i].out);
+    }
+    seconds = now() - start;
+    for (bytes = converted = i = 0; i < npaths; ++i)
+    {
+        bytes += sizes[i];
+        if (latencies[i] >= 0)
+            latencies[converted++] = latencies[i];
+    }
+    qsort(latencies, converted, sizeof(*latencies), compare_doubles);
+    fprintf(stderr, "%lu files, %lu bytes, %lu workers, %.3fs, %.2f MB/s\n",
+            npaths, bytes, nworkers, seconds,
+            seconds > 0 ? bytes / seconds / 1e6 : 0);
+    if (converted > 0)
+        fprintf(stderr, "latency ms: p50 %.3f p90 %.3f p99 %.3f max %.3f\n",
+                percentile(0.50, converted), percentile(0.90, converted),
+                percentile(0.99, converted), percentile(1, converted));
+    if (failures > 0)
+    {
+        fprintf(stderr, "%lu files failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+usage:
+    fprintf(stderr, "Usage: %s [-j WORKERS] [-o DIR] MANIFEST\n", av[0]);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "hl_vt100.h"
+
+/*
+** Measures what archiving the output of a session costs.
+**
+** Usage: capture_bench [-b] [-p] ARCHIVE PROGRAM [ARGS...]
+**
+**     capture_bench /tmp/archive -- cat big.log
+**     capture_bench -b /tmp/archive -- cat big.log
+**
+** Runs PROGRAM in a session archiving its output to the ARCHIVE file
+** (or pipe), until it exits, then prints the CPU time this process
+** spent per archived GB. The output is spliced unless -b asks for
+** buffered writes. -p reads through the pipeline of hl_vt100_pipeline.h.
+** Running with - as ARCHIVE does not archive, for reference.
+*/
+
+static double cpu_seconds(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+        + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+int main(int ac, char **av)
+{
+    struct vt100_headless *vt100;
+    double seconds;
+    double gigabytes;
+    int use_pipeline;
+    int zero_copy;
+    int opt;
+    int fd;
+
+    zero_copy = 1;
+    use_pipeline = 0;
+    while ((opt = getopt(ac, av, "bp")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b': zero_copy = 0; break ;
+        case 'p': use_pipeline = 1; break ;
+        default: goto usage;
+        }
+    }
+    if (optind + 1 >= ac)
+        goto usage;
+    fd = -1;
+    if (av[optind][0] != '-' || av[optind][1] != '\0')
+    {
+        fd = open(av[optind], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1)
+        {
+            perror(av[optind]);
+            return EXIT_FAILURE;
+        }
+    }
+    vt100 = new_vt100_headless();
+    if (vt100 == NULL)
+        return EXIT_FAILURE;
+    vt100->detached = 1;
+    seconds = cpu_seconds();
+    if (vt100_headless_spawn(vt100, av[optind + 1], av + optind + 1) == -1)
+    {
+        perror(av[optind + 1]);
+        return EXIT_FAILURE;
+    }
+    if ((fd != -1 && vt100_headless_capture(vt100, fd, zero_copy) == -1)
+        || (use_pipeline && vt100_headless_pipeline_start(vt100, 0) == -1))
+    {
+        fprintf(stderr, "Can't start archiving\n");
+        return EXIT_FAILURE;
+    }
+    while (vt100_headless_poll(vt100, -1) != -1)
+        ;
+    seconds = cpu_seconds() - seconds;
+    gigabytes = vt100->metrics.bytes_read / 1e9;
+    printf("%.3f GB read, %.3fs of CPU, %.2fs per GB\n", gigabytes,
+           seconds, seconds / gigabytes);
+    if (vt100->capture != NULL)
+        printf("%lu bytes archived, %lu of them spliced%s\n",
+               vt100->capture->bytes, vt100->capture->spliced,
+               vt100->capture->error ? ", with write errors" : "");
+    delete_vt100_headless(vt100);
+    return EXIT_SUCCESS;
+usage:
+    fprintf(stderr, "Usage: %s [-b] [-p] ARCHIVE PROGRAM [ARGS...]\n",
+            av[0]);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,327 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "lw_terminal_vt100.h"
+
+/*
+** Feeds untrusted output to the emulator, checking it survives it.
+**
+** Each input goes to three emulators: one with the parser specialized
+** for it, getting the input in one go, one parsing through the
+** callbacks table and one parsing lazily, both getting it in chunks
+** sized after the first byte. All three must end up with the same
+** screen, their cursor on it and their margins in order, or abort() is
+** called, for the fuzzer to notice.
+**
+** With libFuzzer:
+**   clang -g -O1 -fsanitize=fuzzer,address -DLIBFUZZER -D_GNU_SOURCE \
+**       -Isrc src/fuzz.c src/lw_terminal_parser.c src/lw_terminal_vt100.c \
+**       src/vt100_shm.c -lpthread -lrt -o fuzz
+**   ./fuzz CORPUS_DIR
+** With AFL:
+**   make CC=afl-gcc vt100 fuzz
+**   LD_LIBRARY_PATH=. afl-fuzz -i CORPUS_DIR -o FINDINGS ./fuzz
+**
+** Usage: fuzz [FILE...]
+**        fuzz -r
+**        fuzz -t
+**
+** Without options, runs each FILE, or the standard input, as one
+** input. -r runs the inputs fuzzing found problems with, checking what
+** they leave on the screen too. -t times pathological output instead,
+** like a CSI of a million parameters, failing if any of it is parsed
+** slower than its floor.
+*/
+
+static void discard(void *user_data, void *buffer, size_t len)
+{
+    (void)user_data;
+    (void)buffer;
+    (void)len;
+}
+
+static void string(struct lw_terminal *term_emul,
+                   enum lw_terminal_string_kind kind,
+                   const char *chunk, size_t len, int final)
+{
+    (void)term_emul;
+    (void)final;
+    if (kind > STRING_SOS || (len > 0 && chunk == NULL))
+        abort();
+}
+
+static struct lw_terminal_vt100 *create(int dynamic_dispatch, size_t lazy)
+{
+    struct lw_terminal_vt100 *vt100;
+
+    vt100 = lw_terminal_vt100_init(NULL, NULL);
+    if (vt100 == NULL)
+        abort();
+    vt100->master_write = discard;
+    vt100->dynamic_dispatch = dynamic_dispatch;
+    lw_terminal_vt100_lazy(vt100, lazy);
+    return vt100;
+}
+
+static void check(struct lw_terminal_vt100 *vt100)
+{
+    lw_terminal_vt100_flush(vt100);
+    if (vt100->width > 132 || vt100->height > 80
+        || vt100->x > vt100->width || vt100->y >= vt100->height
+        || vt100->margin_top >= vt100->margin_bottom
+        || vt100->margin_bottom >= vt100->height
+        || vt100->lw_terminal->argc > TERM_STACK_SIZE)
+        abort();
+}
+
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size);
+
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size)
+{
+    static char screens[3][132 * 80];
+    struct lw_terminal_vt100 *vt100[3];
+    size_t chunk;
+    size_t done;
+    unsigned int i;
+
+    vt100[0] = create(0, 0);
+    vt100[1] = create(1, 0);
+    vt100[2] = create(0, 1 << 20);
+    lw_terminal_vt100_strings(vt100[0], ~0U, string);
+    lw_terminal_vt100_read_buf(vt100[0], (const char *)data, size);
+    check(vt100[0]);
+    chunk = size > 0 ? data[0] % 64 + 1 : 1;
+    for (done = 0; done < size; done += chunk)
+        for (i = 1; i < 3; ++i)
+        {
+            lw_terminal_vt100_read_buf(vt100[i], (const char *)data + done,
+                                       size - done < chunk ? size - done
+                                       : chunk);
+            check(vt100[i]);
+        }
+    for (i = 0; i < 3; ++i)
+    {
+        memset(screens[i], 0, sizeof(screens[i]));
+        lw_terminal_vt100_copy_screen(vt100[i], screens[i]);
+        if (i > 0 && memcmp(screens[0], screens[i], sizeof(screens[0])) != 0)
+            abort();
+    }
+    for (i = 0; i < 3; ++i)
+        lw_terminal_vt100_destroy(vt100[i]);
+    return 0;
+}
+
+#ifndef LIBFUZZER
+
+/*
+** Inputs that once broke an invariant, with what must be on the screen
+** after them.
+*/
+static const struct regression
+{
+    const char *input;
+    const char *screen;
+} regressions[] = {
+    /* Cursor saved on 132 columns, restored past the 80th */
+    {"\001\033[?3h\033[1;120H\0337\033[?3l\0338hello", "hello"},
+    /* DECSTBM with a 0 top margin */
+    {"\033[0;0r\033[5;1Hmargins", "margins"},
+    /* Tab stops set and cleared past the last column */
+    {"\033[1;80Hx\033H\033[g\r\ttab", "tab"},
+};
+
+static int run_regressions(void)
+{
+    static char screen[132 * 80 + 1];
+    struct lw_terminal_vt100 *vt100;
+    const char *input;
+    unsigned int i;
+    int failed;
+
+    failed = 0;
+    for (i = 0; i < sizeof(regressions) / sizeof(regressions[0]); ++i)
+    {
+        input = regressions[i].input;
+        LLVMFuzzerTestOneInput((const unsigned char *)input, strlen(input));
+        vt100 = create(0, 0);
+        lw_terminal_vt100_read_buf(vt100, input, strlen(input));
+        check(vt100);
+        lw_terminal_vt100_copy_screen(vt100, screen);
+        screen[vt100->width * vt100->height] = '\0';
+        lw_terminal_vt100_destroy(vt100);
+        if (strstr(screen, regressions[i].screen) == NULL)
+        {
+            printf("regression %u: \"%s\" missing from the screen\n", i,
+                   regressions[i].screen);
+            failed = 1;
+        }
+    }
+    printf("%u regressions, %s\n", i, failed ? "FAILED" : "passed");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#define CHUNK 4096
+#define TIMED_SIZE (4 << 20)
+
+/*
+** Output crafted to be slow to parse, with the throughput it must
+** reach, in MB/s. Floors are low enough for an unoptimized build on a
+** slow machine, high enough for anything worse than linear to miss
+** them by far.
+*/
+static const struct timed
+{
+    const char *name;
+    const char *head;  /* Output once, in front */
+    const char *body;  /* Output repeated up to TIMED_SIZE, or random */
+    double     floor;
+} timed[] = {
+    {"CSI of a million parameters", "\033[", ";", 5},
+    {"CSI of a million digits",     "\033[", "9", 5},
+    {"erase display flood",         "",      "\033[2J", 1},
+    {"erase line flood",            "",      "\033[1K\033[24;80H", 5},
+    {"margins flood",               "",      "\033[2;23r\033[0;0r", 5},
+    {"escape flood",                "",      "\033", 5},
+    {"4MB APC",                     "\033_", "x", 50},
+    {"random bytes",                "",      NULL, 5},
+};
+
+static void make_up(char *output, const struct timed *test)
+{
+    size_t head;
+    size_t body;
+    size_t i;
+
+    head = strlen(test->head);
+    memcpy(output, test->head, head);
+    if (test->body == NULL)
+    {
+        srand(42);
+        for (i = head; i < TIMED_SIZE; ++i)
+            output[i] = rand();
+        return ;
+    }
+    body = strlen(test->body);
+    for (i = head; i < TIMED_SIZE; ++i)
+        output[i] = test->body[(i - head) % body];
+}
+
+static int run_timed(void)
+{
+    struct lw_terminal_vt100 *vt100;
+    struct timespec start;
+    struct timespec end;
+    double seconds;
+    double mbps;
+    char *output;
+    size_t done;
+    unsigned int i;
+    int failed;
+
+    output = malloc(TIMED_SIZE);
+    if (output == NULL)
+        return EXIT_FAILURE;
+    failed = 0;
+    for (i = 0; i < sizeof(timed) / sizeof(timed[0]); ++i)
+    {
+        make_up(output, &timed[i]);
+        vt100 = create(0, 0);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (done = 0; done < TIMED_SIZE; done += CHUNK)
+            lw_terminal_vt100_read_buf(vt100, output + done, CHUNK);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        check(vt100);
+        lw_terminal_vt100_destroy(vt100);
+        seconds = (end.tv_sec - start.tv_sec)
+            + (end.tv_nsec - start.tv_nsec) / 1e9;
+        mbps = TIMED_SIZE / 1e6 / seconds;
+        printf("%-28s %10.2f MB/s (floor %g)%s\n", timed[i].name, mbps,
+               timed[i].floor, mbps < timed[i].floor ? " TOO SLOW" : "");
+        failed |= mbps < timed[i].floor;
+    }
+    free(output);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int run_file(FILE *file)
+{
+    unsigned char *data;
+    unsigned char *bigger;
+    size_t size;
+    size_t len;
+
+    size = 4096;
+    len = 0;
+    data = malloc(size);
+    while (data != NULL)
+    {
+        len += fread(data + len, 1, size - len, file);
+        if (len < size)
+            break ;
+        size *= 2;
+        bigger = realloc(data, size);
+        if (bigger == NULL)
+            free(data);
+        data = bigger;
+    }
+    if (data == NULL || ferror(file))
+    {
+        free(data);
+        return -1;
+    }
+    LLVMFuzzerTestOneInput(data, len);
+    free(data);
+    return 0;
+}
+
+int main(int ac, char **av)
+{
+    FILE *file;
+    int i;
+
+    if (ac == 2 && strcmp(av[1], "-t") == 0)
+        return run_timed();
+    if (ac == 2 && strcmp(av[1], "-r") == 0)
+        return run_regressions();
+    if (ac == 1)
+        return run_file(stdin) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    for (i = 1; i < ac; ++i)
+    {
+        file = fopen(av[i], "rb");
+        if (file == NULL || run_file(file) == -1)
+        {
+            perror(av[i]);
+            return EXIT_FAILURE;
+        }
+        fclose(file);
+    }
+    return EXIT_SUCCESS;
+}
+
+#endif
@@ -23,21 +23,106 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#define _XOPEN_SOURCE
+#ifndef _GNU_SOURCE
+#    define _GNU_SOURCE
+#endif
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <pty.h>
+#include <poll.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <time.h>
 #include "hl_vt100.h"
 
+/*
+** Hibernates the emulator if the child has been quiet for
+** hibernate_after_usec. Event loops call it when they have nothing
+** else to do. Returns 1 if the emulator is hibernating.
+*/
+int vt100_headless_hibernate_idle(struct vt100_headless *this)
+{
+    unsigned long now;
+    unsigned long active;
+
+    if (this->term->hibernation != NULL)
+        return 1;
+    if (this->hibernate_after_usec == 0)
+        return 0;
+    now = vt100_headless_now(this);
+    /* Reading the screen counts as activity, or readers would thrash */
+    if (this->term->resumes != this->resumes_seen)
+    {
+        this->resumes_seen = this->term->resumes;
+        this->woken_usec = now;
+    }
+    active = this->last_output_usec > this->woken_usec
+        ? this->last_output_usec : this->woken_usec;
+    if (now - active < this->hibernate_after_usec)
+        return 0;
+    return lw_terminal_vt100_hibernate(this->term) == 0;
+}
+
+/*
+** Resizes the screen and tells the child, which gets a SIGWINCH.
+*/
+int vt100_headless_resize(struct vt100_headless *this,
+                          unsigned int width, unsigned int height)
+{
+    struct winsize winsize;
+
+    if (lw_terminal_vt100_resize(this->term, width, height) == -1)
+        return -1;
+    if (this->master == -1 || this->master_closed)
+        return 0;
+    memset(&winsize, 0, sizeof(winsize));
+    winsize.ws_row = height;
+    winsize.ws_col = width;
+    return ioctl(this->master, TIOCSWINSZ, &winsize);
+}
+
+static void master_write(void *user_data, void *buffer, size_t len);
+
 struct vt100_headless *new_vt100_headless(void)
 {
-    return calloc(1, sizeof(struct vt100_headless));
+    struct vt100_headless *this;
+
+    this = calloc(1, sizeof(struct vt100_headless));
+    if (this == NULL)
+        return NULL;
+    this->master = -1;
+    this->pidfd = -1;
+    this->term = lw_terminal_vt100_init(this, lw_terminal_parser_default_unimplemented);
+    if (this->term == NULL)
+    {
+        free(this);
+        return NULL;
+    }
+    this->term->master_write = master_write;
+    vt100_metrics_register(this);
+    return this;
 }
 
 void delete_vt100_headless(struct vt100_headless *this)
 {
+    vt100_metrics_unregister(this);
+    vt100_headless_pipeline_stop(this);
+    if (this->pidfd != -1)
+        close(this->pidfd);
+    if (this->master != -1)
+        close(this->master);
+    if (this->child > 0 && !this->child_exited)
+        waitpid(this->child, NULL, WNOHANG);
+    vt100_record_close(this->record);
+    vt100_scrollback_close(this->scrollback);
+    vt100_capture_close(this->capture);
+    vt100_expect_destroy(this->expect);
+    lw_terminal_vt100_destroy(this->term);
     free(this);
 }
 
@@ -59,9 +144,12 @@ static void restore_termios(struct vt100_headless *this, int fd)
 }
 
 #ifndef NDEBUG
-static void strdump(char *str)
+static void strdump(const char *str, size_t len)
 {
-    while (*str != '\0')
+    const char *end;
+
+    end = str + len;
+    while (str < end)
     {
         if (*str >= ' ' && *str <= '~')
             fprintf(stderr, "%c", *str);
@@ -78,55 +166,379 @@ void vt100_headless_stop(struct vt100_headless *this)
     this->should_quit = 1;
 }
 
-int vt100_headless_main_loop(struct vt100_headless *this)
+unsigned long vt100_headless_now(struct vt100_headless *this)
 {
-    char buffer[4096];
-    fd_set rfds;
-    int retval;
-    ssize_t read_size;
+    struct timespec now;
 
-    while (!this->should_quit)
+    if (this->clock != NULL)
+        return this->clock(this->clock_data);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000UL + now.tv_nsec / 1000;
+}
+
+/*
+** Records every chunk read from the master from now on, see
+** vt100_record.h for the format. A failed write stops the record there
+** and sets record_error.
+*/
+int vt100_headless_record(struct vt100_headless *this, const char *path)
+{
+    vt100_record_close(this->record);
+    this->record_error = 0;
+    this->record = vt100_record_open(path);
+    return this->record == NULL ? -1 : 0;
+}
+
+static void scrolled_out(void *user_data, const char *line,
+                         unsigned int width)
+{
+    struct vt100_headless *this;
+
+    this = (struct vt100_headless *)user_data;
+    vt100_scrollback_append(this->scrollback, line, width);
+}
+
+/*
+** Keeps the lines scrolling off the screen from now on in an on-disk
+** store, see vt100_scrollback.h. Lazy parsing gets turned off.
+*/
+int vt100_headless_scrollback(struct vt100_headless *this, const char *path)
+{
+    lw_terminal_vt100_lazy(this->term, 0);
+    this->term->scrolled_out = NULL;
+    vt100_scrollback_close(this->scrollback);
+    this->scrollback = vt100_scrollback_open(path);
+    if (this->scrollback == NULL)
+        return -1;
+    this->term->scrolled_out = scrolled_out;
+    return 0;
+}
+
+/*
+** Archives everything read from the master from now on to fd, a file
+** or a pipe, without copying it when zero_copy is set and the kernel
+** allows, see vt100_capture.h. fd is -1 to stop archiving, it is not
+** closed by the session. Returns -1 if resources are short.
+*/
+int vt100_headless_capture(struct vt100_headless *this, int fd, int zero_copy)
+{
+    size_t ring_size;
+    int ret;
+
+    /* The I/O thread reads through the capture */
+    ring_size = this->pipeline != NULL ? this->pipeline->size : 0;
+    vt100_headless_pipeline_stop(this);
+    vt100_capture_close(this->capture);
+    this->capture = NULL;
+    ret = 0;
+    if (fd != -1)
     {
-        FD_ZERO(&rfds);
-        FD_SET(this->master, &rfds);
-        FD_SET(0, &rfds);
-        retval = select(this->master + 1, &rfds, NULL, NULL, NULL);
-        if (retval == -1)
+        this->capture = vt100_capture_open(fd, zero_copy);
+        if (this->capture == NULL)
+            ret = -1;
+    }
+    if (ring_size != 0 && vt100_headless_pipeline_start(this, ring_size) == -1)
+        ret = -1;
+    return ret;
+}
+
+/*
+** Writes input for the child, as if typed, stamping it so the latency
+** of the screen's answer gets measured.
+*/
+ssize_t vt100_headless_write(struct vt100_headless *this,
+                             const char *buffer, size_t len)
+{
+    ssize_t written;
+    size_t total;
+
+    if (this->input_usec == 0)
+        this->input_usec = vt100_headless_now(this);
+    total = 0;
+    while (total < len)
+    {
+        written = write(this->master, buffer + total, len - total);
+        if (written == -1)
         {
-            perror("select()");
+            if (errno == EINTR)
+                continue ;
+            if (errno == EAGAIN)
+                break ;
+            return -1;
         }
-        if (FD_ISSET(0, &rfds))
+        total += written;
+    }
+    return total;
+}
+
+static int screen_answered(struct lw_terminal_vt100 *vt100,
+                           unsigned int x, unsigned int y)
+{
+    unsigned int row;
+
+    if (vt100->x != x || vt100->y != y)
+        return 1;
+    for (row = 0; row < vt100->height; ++row)
+        if (vt100->line_generation[row] == vt100->generation)
+            return 1;
+    return 0;
+}
+
+/*
+** Everything the session receives goes through here, be it read from
+** the master or injected by a replay, so matchers and the changed
+** callback see the same thing in both cases.
+*/
+void vt100_headless_feed(struct vt100_headless *this,
+                         const char *buffer, size_t len)
+{
+    struct timespec start;
+    struct timespec end;
+    unsigned int x;
+    unsigned int y;
+
+#ifndef NDEBUG
+    strdump(buffer, len);
+#endif
+    if (this->input_usec != 0)
+        lw_terminal_vt100_flush(this->term);
+    x = this->term->x;
+    y = this->term->y;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    lw_terminal_vt100_read_buf(this->term, buffer, len);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (this->input_usec != 0)
+    {
+        /* Answers don't wait for lazy parsing */
+        lw_terminal_vt100_flush(this->term);
+        if (screen_answered(this->term, x, y))
         {
-            read_size = read(0, &buffer, 4096);
-            if (read_size == -1)
-            {
-                perror("read");
-                return EXIT_FAILURE;
-            }
-            buffer[read_size] = '\0';
-            write(this->master, buffer, read_size);
+            vt100_latency_add(&this->latency,
+                              vt100_headless_now(this) - this->input_usec);
+            this->input_usec = 0;
         }
-        if (FD_ISSET(this->master, &rfds))
+    }
+    vt100_metrics_account(this, len,
+                          (end.tv_sec - start.tv_sec) * 1000000000UL
+                          + end.tv_nsec - start.tv_nsec,
+                          this->changed != NULL);
+    /* A second pass over the chunk, still in cache, see hl_vt100_expect.h */
+    vt100_expect_feed(this, buffer, len);
+    vt100_expect_check_screen(this);
+    if (this->changed != NULL)
+        this->changed(this);
+}
+
+/*
+** Collects the child's exit status, waiting for it if block is set.
+** Returns child_exited.
+*/
+int vt100_headless_reap(struct vt100_headless *this, int block)
+{
+    int status;
+
+    if (this->child <= 0 || this->child_exited)
+        return this->child_exited;
+    if (waitpid(this->child, &status, block ? 0 : WNOHANG) == this->child)
+    {
+        this->child_exited = 1;
+        this->exit_status = status;
+    }
+    return this->child_exited;
+}
+
+/*
+** Returns the number of bytes read and parsed, 0 if there was nothing
+** to read, -1 once the master hung up.
+*/
+static ssize_t vt100_headless_read_master(struct vt100_headless *this)
+{
+    char buffer[4096];
+    ssize_t read_size;
+
+    if (this->capture != NULL)
+        read_size = vt100_capture_read(this->capture, this->master,
+                                       buffer, sizeof(buffer));
+    else
+        read_size = read(this->master, &buffer, sizeof(buffer));
+    if (read_size <= 0)
+    {
+        if (read_size == -1 && (errno == EINTR || errno == EAGAIN))
+            return 0;
+        /*
+        ** EOF or EIO: every slave fd is gone, nothing more will come.
+        ** The child may not have exited yet, and reading must not
+        ** block, so reaping is left to the caller.
+        */
+        this->master_closed = 1;
+        vt100_headless_reap(this, 0);
+        return -1;
+    }
+    if (this->record != NULL
+        && vt100_record_chunk(this->record, vt100_headless_now(this),
+                              buffer, read_size) == -1)
+        this->record_error = this->record->error;
+    vt100_headless_feed(this, buffer, read_size);
+    return read_size;
+}
+
+/*
+** The descriptor event loops wait on for output: the master, or the
+** pipeline's when it runs, see hl_vt100_pipeline.h.
+*/
+int vt100_headless_fd(struct vt100_headless *this)
+{
+    if (this->pipeline != NULL)
+        return this->pipeline->data_fd;
+    return this->master;
+}
+
+/*
+** For callers running their own event loop on vt100_headless_fd: reads and
+** parses what is available right now, up to VT100_PUMP_BUDGET bytes so
+** a chatty child can't starve the loop, without ever blocking.
+** Returns the number of bytes parsed, or -1 once the master hung up, at
+** which point the child can be reaped (its pidfd becomes readable).
+** Without a pidfd, the child may exit a bit after hanging up: poll
+** vt100_headless_reap(this, 0) until it returns 1.
+*/
+int vt100_headless_pump(struct vt100_headless *this)
+{
+    ssize_t read_size;
+    int total;
+
+    if (this->master == -1 || this->master_closed)
+        return -1;
+    if (this->pipeline != NULL)
+        return vt100_headless_pipeline_drain(this);
+    if (!this->nonblocking)
+    {
+        fcntl(this->master, F_SETFL,
+              fcntl(this->master, F_GETFL) | O_NONBLOCK);
+        this->nonblocking = 1;
+    }
+    total = 0;
+    while (total < VT100_PUMP_BUDGET)
+    {
+        read_size = vt100_headless_read_master(this);
+        if (read_size == -1)
+            return total > 0 ? total : -1;
+        if (read_size == 0)
+            break ;
+        total += read_size;
+    }
+    return total;
+}
+
+static void vt100_headless_forward_stdin(struct vt100_headless *this)
+{
+    char buffer[4096];
+    ssize_t read_size;
+
+    read_size = read(0, &buffer, sizeof(buffer));
+    if (read_size <= 0)
+    {
+        if (read_size == -1 && errno == EINTR)
+            return ;
+        if (read_size == -1)
+            perror("read");
+        this->stdin_closed = 1;
+        return ;
+    }
+    write(this->master, buffer, read_size);
+}
+
+/*
+** Waits at most timeout_ms (forever if negative) for the child, its
+** exit, or stdin (unless detached) to have something to say, and
+** processes it.
+** Once the child exited, the master is only drained of what is
+** already buffered, so a grandchild holding the slave open does not
+** keep the session alive.
+** Returns 1 if something was processed, 0 on timeout, -1 on error or
+** when the session is over, in which case child_exited and
+** exit_status tell how the child ended.
+*/
+int vt100_headless_poll(struct vt100_headless *this, int timeout_ms)
+{
+    struct pollfd fds[3];
+    nfds_t nfds;
+    int master;
+    int pidfd;
+    int input;
+    int retval;
+
+    /* The master is drained directly once the child is gone, see below */
+    if (this->child_exited && this->pipeline != NULL)
+        vt100_headless_pipeline_stop(this);
+    nfds = 0;
+    master = pidfd = input = -1;
+    if (this->master != -1 && !this->master_closed)
+    {
+        fds[nfds].fd = vt100_headless_fd(this);
+        fds[nfds].events = POLLIN;
+        master = nfds++;
+    }
+    if (this->pidfd != -1 && !this->child_exited)
+    {
+        fds[nfds].fd = this->pidfd;
+        fds[nfds].events = POLLIN;
+        pidfd = nfds++;
+    }
+    if (master == -1 && pidfd == -1)
+        return -1;
+    if (!this->detached && !this->stdin_closed)
+    {
+        fds[nfds].fd = 0;
+        fds[nfds].events = POLLIN;
+        input = nfds++;
+    }
+    if (this->child_exited)
+        timeout_ms = 0;
+    retval = poll(fds, nfds, timeout_ms);
+    if (retval == -1)
+    {
+        if (errno == EINTR)
+            return 0;
+        perror("poll()");
+        return -1;
+    }
+    if (retval == 0)
+    {
+        if (!this->child_exited)
         {
-            read_size = read(this->master, &buffer, 4096);
-            if (read_size == -1)
-            {
-                perror("read");
-                return EXIT_FAILURE;
-            }
-            buffer[read_size] = '\0';
-#ifndef NDEBUG
-            strdump(buffer);
-#endif
-            lw_terminal_vt100_read_str(this->term, buffer);
-            if (this->changed != NULL)
-                this->changed(this);
+            vt100_headless_hibernate_idle(this);
+            return 0;
         }
+        this->master_closed = 1;
+        return -1;
     }
+    if (input != -1 && fds[input].revents)
+        vt100_headless_forward_stdin(this);
+    if (master != -1 && fds[master].revents)
+    {
+        if (this->pipeline != NULL)
+            retval = vt100_headless_pipeline_drain(this);
+        else
+            retval = vt100_headless_read_master(this);
+        /* Without a pidfd, the hang up is the only news of the exit */
+        if (retval == -1 && this->pidfd == -1)
+            vt100_headless_reap(this, 1);
+    }
+    if (pidfd != -1 && fds[pidfd].revents)
+        vt100_headless_reap(this, 0);
+    return 1;
+}
+
+int vt100_headless_main_loop(struct vt100_headless *this)
+{
+    while (!this->should_quit)
+        if (vt100_headless_poll(this, -1) == -1)
+            return this->master_closed ? EXIT_SUCCESS : EXIT_FAILURE;
     return EXIT_SUCCESS;
 }
 
-void master_write(void *user_data, void *buffer, size_t len)
+static void master_write(void *user_data, void *buffer, size_t len)
 {
     struct vt100_headless *this;
 
@@ -139,29 +551,139 @@ const char **vt100_headless_getlines(struct vt100_headless *this)
     return lw_terminal_vt100_getlines(this->term);
 }
 
+/*
+** In detached mode fd 0 is left alone, both here and in the main loop,
+** so sessions can run from a daemon.
+*/
 void vt100_headless_fork(struct vt100_headless *this,
                          const char *progname,
                          char **argv)
 {
     int child;
+    int master;
     struct winsize winsize;
 
-    set_non_canonical(this, 0);
-    winsize.ws_row = 24;
-    winsize.ws_col = 80;
-    child = forkpty(&this->master, NULL, NULL, NULL);
+    if (!this->detached)
+        set_non_canonical(this, 0);
+    memset(&winsize, 0, sizeof(winsize));
+    winsize.ws_row = this->term->height;
+    winsize.ws_col = this->term->width;
+    child = forkpty(&master, NULL, NULL, &winsize);
     if (child == CHILD)
     {
         setsid();
         putenv("TERM=vt100");
         execvp(progname, argv);
-        return ;
+        _exit(EXIT_FAILURE);
     }
-    else
+    else if (child > 0)
+    {
+        /* The metrics thread reads both */
+        __atomic_store_n(&this->master, master, __ATOMIC_RELAXED);
+        __atomic_store_n(&this->child, child, __ATOMIC_RELAXED);
+        /* Keep it out of the children of other sessions */
+        fcntl(this->master, F_SETFD, FD_CLOEXEC);
+#ifdef SYS_pidfd_open
+        this->pidfd = syscall(SYS_pidfd_open, child, 0);
+#endif
+    }
+    if (!this->detached)
+        restore_termios(this, 0);
+}
+
+/*
+** The environment the child gets: ours, with TERM set to vt100.
+*/
+static char **spawn_environment(void)
+{
+    char **envp;
+    size_t count;
+    size_t i;
+
+    for (count = 0; environ[count] != NULL; ++count)
+        ;
+    envp = malloc((count + 2) * sizeof(*envp));
+    if (envp == NULL)
+        return NULL;
+    envp[0] = "TERM=vt100";
+    for (count = 1, i = 0; environ[i] != NULL; ++i)
+        if (strncmp(environ[i], "TERM=", 5) != 0)
+            envp[count++] = environ[i];
+    envp[count] = NULL;
+    return envp;
+}
+
+/*
+** vt100_headless_fork for callers starting sessions by the hundred.
+** The PTY and its size are set up first, then the child is started by
+** posix_spawn, which does not duplicate the parent's memory like
+** forkpty does, and reports an exec failure right away. fd 0 is never
+** touched, whatever detached says.
+** Returns 0, or -1 with errno set if the child could not be started.
+*/
+int vt100_headless_spawn(struct vt100_headless *this,
+                         const char *progname, char **argv)
+{
+#ifdef POSIX_SPAWN_SETSID
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    struct winsize winsize;
+    char slave[64];
+    char **envp;
+    pid_t child;
+    int master;
+    int error;
+
+    envp = spawn_environment();
+    if (envp == NULL)
+        return -1;
+    master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (master == -1)
+        goto free_envp;
+    if (grantpt(master) == -1 || unlockpt(master) == -1
+        || ptsname_r(master, slave, sizeof(slave)) != 0)
+        goto close_master;
+    memset(&winsize, 0, sizeof(winsize));
+    winsize.ws_row = this->term->height;
+    winsize.ws_col = this->term->width;
+    ioctl(master, TIOCSWINSZ, &winsize);
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+    /* Opened once the child leads its session: it becomes its terminal */
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID);
+    posix_spawn_file_actions_addopen(&actions, 0, slave, O_RDWR, 0);
+    posix_spawn_file_actions_adddup2(&actions, 0, 1);
+    posix_spawn_file_actions_adddup2(&actions, 0, 2);
+    error = posix_spawnp(&child, progname, &actions, &attr, argv, envp);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    if (error != 0)
     {
-        this->term = lw_terminal_vt100_init(this, lw_terminal_parser_default_unimplemented);
-        this->term->master_write = master_write;
-        ioctl(this->master, TIOCSWINSZ, &winsize);
+        errno = error;
+        goto close_master;
     }
-    restore_termios(this, 0);
+    free(envp);
+    /* The metrics thread reads both */
+    __atomic_store_n(&this->master, master, __ATOMIC_RELAXED);
+    __atomic_store_n(&this->child, child, __ATOMIC_RELAXED);
+#ifdef SYS_pidfd_open
+    this->pidfd = syscall(SYS_pidfd_open, child, 0);
+#endif
+    return 0;
+close_master:
+    error = errno;
+    close(master);
+    errno = error;
+free_envp:
+    free(envp);
+    return -1;
+#else
+    int detached;
+
+    detached = this->detached;
+    this->detached = 1;
+    vt100_headless_fork(this, progname, argv);
+    this->detached = detached;
+    return this->master == -1 ? -1 : 0;
+#endif
 }
@@ -27,12 +27,20 @@
 #define __VT100_HEADLESS_H__
 
 #define CHILD 0
+#define VT100_PUMP_BUDGET (64 * 1024)
 
 #include <utmp.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
 #include <termios.h>
 #include "lw_terminal_vt100.h"
+#include "hl_vt100_expect.h"
+#include "vt100_record.h"
+#include "vt100_scrollback.h"
+#include "vt100_capture.h"
+#include "hl_vt100_metrics.h"
+#include "hl_vt100_latency.h"
+#include "hl_vt100_pipeline.h"
 
 struct vt100_headless
 {
@@ -41,11 +49,58 @@ struct vt100_headless
     struct lw_terminal_vt100 *term;
     int should_quit;
     void (*changed)(struct vt100_headless *this);
+    struct vt100_expect *expect;
+    int detached; /* Set before forking to keep away from fd 0 */
+    pid_t child;
+    int pidfd; /* -1 when pidfd_open is not available */
+    int master_closed;
+    int stdin_closed;
+    int child_exited;
+    int exit_status; /* As returned by waitpid, valid once child_exited */
+    struct vt100_record *record;
+    int record_error; /* errno that stopped the record, 0 if none */
+    struct vt100_scrollback *scrollback; /* NULL unless kept */
+    struct vt100_capture *capture; /* NULL unless archiving */
+    /* Microseconds from an arbitrary origin, CLOCK_MONOTONIC if NULL */
+    unsigned long (*clock)(void *clock_data);
+    void *clock_data;
+    int nonblocking;
+    unsigned int id; /* Labels the session in the metrics */
+    struct vt100_metrics metrics;
+    unsigned long started_usec;
+    unsigned long last_output_usec;
+    struct vt100_headless *prev_session;
+    struct vt100_headless *next_session;
+    /* When unanswered input was written, 0 if there is none */
+    unsigned long input_usec;
+    struct vt100_latency latency;
+    /* Idle time after which the emulator hibernates, 0 for never */
+    unsigned long hibernate_after_usec;
+    unsigned long woken_usec; /* When a reader last woke it up */
+    unsigned long resumes_seen;
+    struct vt100_pipeline *pipeline; /* NULL unless started */
 };
 
 
 void vt100_headless_fork(struct vt100_headless *this, const char *progname, char **argv);
+int vt100_headless_spawn(struct vt100_headless *this,
+                         const char *progname, char **argv);
 int vt100_headless_main_loop(struct vt100_headless *this);
+int vt100_headless_poll(struct vt100_headless *this, int timeout_ms);
+int vt100_headless_pump(struct vt100_headless *this);
+int vt100_headless_fd(struct vt100_headless *this);
+int vt100_headless_reap(struct vt100_headless *this, int block);
+void vt100_headless_feed(struct vt100_headless *this,
+                         const char *buffer, size_t len);
+int vt100_headless_record(struct vt100_headless *this, const char *path);
+int vt100_headless_scrollback(struct vt100_headless *this, const char *path);
+int vt100_headless_capture(struct vt100_headless *this, int fd, int zero_copy);
+unsigned long vt100_headless_now(struct vt100_headless *this);
+ssize_t vt100_headless_write(struct vt100_headless *this,
+                             const char *buffer, size_t len);
+int vt100_headless_resize(struct vt100_headless *this,
+                          unsigned int width, unsigned int height);
+int vt100_headless_hibernate_idle(struct vt100_headless *this);
 void delete_vt100_headless(struct vt100_headless *this);
 struct vt100_headless *new_vt100_headless(void);
 const char **vt100_headless_getlines(struct vt100_headless *this);
@@ -0,0 +1,377 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "hl_vt100.h"
+
+static struct vt100_expect *vt100_expect_get(struct vt100_headless *this)
+{
+    if (this->expect == NULL)
+    {
+        this->expect = calloc(1, sizeof(*this->expect));
+        if (this->expect == NULL)
+            return NULL;
+        this->expect->matched = -1;
+    }
+    return this->expect;
+}
+
+static void vt100_expect_free_dfa(struct vt100_expect *this)
+{
+    free(this->delta);
+    free(this->output);
+    free(this->report);
+    free(this->link);
+    this->delta = NULL;
+    this->output = NULL;
+    this->report = NULL;
+    this->link = NULL;
+    this->nstates = 0;
+    this->state = 0;
+}
+
+/*
+** Builds the Aho-Corasick automaton as a full DFA: every state has its
+** 256 transitions resolved, so stepping costs a single table lookup.
+** report[s] is the nearest state in the suffix chain of s (s included)
+** where a pattern ends, link[s] continues that chain.
+*/
+static int vt100_expect_build(struct vt100_expect *this)
+{
+    struct vt100_expect_pattern *pattern;
+    unsigned int i;
+    size_t j;
+    int total;
+    int *fail;
+    int *queue;
+    int head;
+    int tail;
+    int state;
+    int next;
+    int c;
+
+    vt100_expect_free_dfa(this);
+    total = 1;
+    for (i = 0; i < this->npatterns; ++i)
+        if (this->patterns[i]->active
+            && this->patterns[i]->flags & VT100_EXPECT_STREAM)
+            total += this->patterns[i]->len;
+    if (total == 1)
+    {
+        this->dirty = 0;
+        return 0;
+    }
+    this->delta = malloc(total * 256 * sizeof(*this->delta));
+    this->output = malloc(total * sizeof(*this->output));
+    this->report = malloc(total * sizeof(*this->report));
+    this->link = malloc(total * sizeof(*this->link));
+    fail = malloc(total * sizeof(*fail));
+    queue = malloc(total * sizeof(*queue));
+    if (this->delta == NULL || this->output == NULL || this->report == NULL
+        || this->link == NULL || fail == NULL || queue == NULL)
+        goto fail;
+    memset(this->delta, -1, total * 256 * sizeof(*this->delta));
+    memset(this->output, -1, total * sizeof(*this->output));
+    this->nstates = 1;
+    for (i = 0; i < this->npatterns; ++i)
+    {
+        pattern = this->patterns[i];
+        if (!pattern->active || !(pattern->flags & VT100_EXPECT_STREAM))
+            continue;
+        state = 0;
+        for (j = 0; j < pattern->len; ++j)
+        {
+            c = (unsigned char)pattern->literal[j];
+            if (this->delta[state * 256 + c] == -1)
+                this->delta[state * 256 + c] = this->nstates++;
+            state = this->delta[state * 256 + c];
+        }
+        pattern->next = this->output[state];
+        this->output[state] = i;
+    }
+    head = tail = 0;
+    fail[0] = 0;
+    this->report[0] = -1;
+    this->link[0] = -1;
+    for (c = 0; c < 256; ++c)
+    {
+        next = this->delta[c];
+        if (next == -1)
+            this->delta[c] = 0;
+        else
+        {
+            fail[next] = 0;
+            queue[tail++] = next;
+        }
+    }
+    while (head < tail)
+    {
+        state = queue[head++];
+        this->link[state] = this->report[fail[state]];
+        this->report[state] = this->output[state] >= 0
+            ? state : this->link[state];
+        for (c = 0; c < 256; ++c)
+        {
+            next = this->delta[state * 256 + c];
+            if (next == -1)
+                this->delta[state * 256 + c] = this->delta[fail[state] * 256 + c];
+            else
+            {
+                fail[next] = this->delta[fail[state] * 256 + c];
+                queue[tail++] = next;
+            }
+        }
+    }
+    free(fail);
+    free(queue);
+    /* Left dirty on failure, so the next chunk tries again */
+    this->dirty = 0;
+    return 0;
+fail:
+    free(fail);
+    free(queue);
+    vt100_expect_free_dfa(this);
+    return -1;
+}
+
+static void vt100_expect_hit(struct vt100_headless *this, int id, int row)
+{
+    struct vt100_expect_pattern *pattern;
+
+    pattern = this->expect->patterns[id];
+    if (this->expect->matched < 0)
+    {
+        this->expect->matched = id;
+        this->expect->matched_row = row;
+    }
+    if (pattern->callback != NULL)
+        pattern->callback(this, id, row, pattern->user_data);
+}
+
+int vt100_headless_expect_add(struct vt100_headless *this,
+                              const char *pattern, size_t len, int flags,
+                              vt100_expect_callback callback,
+                              void *user_data)
+{
+    struct vt100_expect *expect;
+    struct vt100_expect_pattern *new;
+    struct vt100_expect_pattern **patterns;
+
+    if (len == 0 || !(flags & (VT100_EXPECT_STREAM | VT100_EXPECT_SCREEN)))
+        return -1;
+    if ((flags & VT100_EXPECT_REGEX) && (flags & VT100_EXPECT_STREAM))
+        return -1;
+    expect = vt100_expect_get(this);
+    if (expect == NULL)
+        return -1;
+    new = calloc(1, sizeof(*new));
+    if (new == NULL)
+        return -1;
+    new->literal = malloc(len + 1);
+    if (new->literal == NULL)
+        goto free_new;
+    memcpy(new->literal, pattern, len);
+    new->literal[len] = '\0';
+    new->len = len;
+    new->flags = flags;
+    new->callback = callback;
+    new->user_data = user_data;
+    if ((flags & VT100_EXPECT_REGEX)
+        && regcomp(&new->regex, new->literal, REG_EXTENDED | REG_NOSUB) != 0)
+        goto free_literal;
+    patterns = realloc(expect->patterns,
+                       (expect->npatterns + 1) * sizeof(*patterns));
+    if (patterns == NULL)
+        goto free_regex;
+    expect->patterns = patterns;
+    new->active = 1;
+    new->fresh = 1;
+    if (flags & VT100_EXPECT_STREAM)
+        expect->dirty = 1;
+    if (flags & VT100_EXPECT_SCREEN)
+        expect->screen_patterns += 1;
+    expect->patterns[expect->npatterns] = new;
+    return expect->npatterns++;
+free_regex:
+    if (flags & VT100_EXPECT_REGEX)
+        regfree(&new->regex);
+free_literal:
+    free(new->literal);
+free_new:
+    free(new);
+    return -1;
+}
+
+void vt100_headless_expect_remove(struct vt100_headless *this, int id)
+{
+    struct vt100_expect_pattern *pattern;
+
+    if (this->expect == NULL || id < 0
+        || (unsigned int)id >= this->expect->npatterns)
+        return ;
+    pattern = this->expect->patterns[id];
+    if (!pattern->active)
+        return ;
+    pattern->active = 0;
+    if (pattern->flags & VT100_EXPECT_STREAM)
+        this->expect->dirty = 1;
+    if (pattern->flags & VT100_EXPECT_SCREEN)
+        this->expect->screen_patterns -= 1;
+}
+
+void vt100_expect_feed(struct vt100_headless *this,
+                       const char *buffer, size_t len)
+{
+    struct vt100_expect *expect;
+    const unsigned char *c;
+    const unsigned char *end;
+    int state;
+    int hit;
+    int id;
+
+    expect = this->expect;
+    if (expect == NULL)
+        return ;
+    if (expect->dirty && vt100_expect_build(expect) == -1)
+        return ;
+    if (expect->nstates == 0)
+        return ;
+    state = expect->state;
+    c = (const unsigned char *)buffer;
+    end = c + len;
+    while (c < end)
+    {
+        state = expect->delta[state * 256 + *c++];
+        for (hit = expect->report[state]; hit >= 0; hit = expect->link[hit])
+            for (id = expect->output[hit]; id >= 0;
+                 id = expect->patterns[id]->next)
+                if (expect->patterns[id]->active)
+                    vt100_expect_hit(this, id, -1);
+    }
+    expect->state = state;
+}
+
+static int vt100_expect_match_row(struct vt100_expect_pattern *pattern,
+                                  const char *line, unsigned int width,
+                                  char *row)
+{
+    if (!(pattern->flags & VT100_EXPECT_REGEX))
+        return memmem(line, width, pattern->literal, pattern->len) != NULL;
+    if (row[0] == '\0')
+    {
+        memcpy(row, line, width);
+        row[width] = '\0';
+    }
+    return regexec(&pattern->regex, row, 0, NULL, 0) == 0;
+}
+
+void vt100_expect_check_screen(struct vt100_headless *this)
+{
+    struct vt100_expect *expect;
+    struct vt100_expect_pattern *pattern;
+    struct lw_terminal_vt100 *vt100;
+    const char **lines;
+    char row[133];
+    unsigned int y;
+    unsigned int id;
+    int dirty;
+
+    expect = this->expect;
+    if (expect == NULL || expect->screen_patterns == 0)
+        return ;
+    vt100 = this->term;
+    lines = lw_terminal_vt100_getlines(vt100);
+    for (y = 0; y < vt100->height; ++y)
+    {
+        dirty = (int)(vt100->line_generation[y]
+                      - expect->screen_generation) > 0;
+        row[0] = '\0';
+        for (id = 0; id < expect->npatterns; ++id)
+        {
+            pattern = expect->patterns[id];
+            if (!pattern->active || !(pattern->flags & VT100_EXPECT_SCREEN))
+                continue;
+            if (!dirty && !pattern->fresh)
+                continue;
+            if (vt100_expect_match_row(pattern, lines[y], vt100->width, row))
+                vt100_expect_hit(this, id, y);
+        }
+    }
+    for (id = 0; id < expect->npatterns; ++id)
+        expect->patterns[id]->fresh = 0;
+    expect->screen_generation = vt100->generation;
+}
+
+/*
+** Drives the session until any pattern matches, returns its id, or -1
+** on timeout (a negative timeout_ms waits forever) or end of session.
+*/
+int vt100_headless_expect(struct vt100_headless *this, int timeout_ms)
+{
+    struct vt100_expect *expect;
+    unsigned long start;
+    unsigned long elapsed;
+    int remaining;
+
+    expect = vt100_expect_get(this);
+    if (expect == NULL)
+        return -1;
+    expect->matched = -1;
+    vt100_expect_check_screen(this);
+    start = vt100_headless_now(this);
+    remaining = timeout_ms;
+    while (expect->matched < 0 && !this->should_quit)
+    {
+        if (timeout_ms >= 0)
+        {
+            elapsed = (vt100_headless_now(this) - start) / 1000;
+            if (elapsed >= (unsigned long)timeout_ms)
+                break ;
+            remaining = timeout_ms - elapsed;
+        }
+        if (vt100_headless_poll(this, remaining) == -1)
+            break ;
+    }
+    return expect->matched;
+}
+
+void vt100_expect_destroy(struct vt100_expect *this)
+{
+    unsigned int i;
+
+    if (this == NULL)
+        return ;
+    for (i = 0; i < this->npatterns; ++i)
+    {
+        if (this->patterns[i]->flags & VT100_EXPECT_REGEX)
+            regfree(&this->patterns[i]->regex);
+        free(this->patterns[i]->literal);
+        free(this->patterns[i]);
+    }
+    free(this->patterns);
+    vt100_expect_free_dfa(this);
+    free(this);
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __VT100_HEADLESS_EXPECT_H__
+#define __VT100_HEADLESS_EXPECT_H__
+
+#include <stddef.h>
+#include <regex.h>
+
+/*
+** expect-style matchers for a vt100_headless.
+**
+** Stream patterns are literals matched against the raw bytes read from
+** the master. All of them are compiled into a single Aho-Corasick
+** automaton stepped over each chunk right after it has been parsed, so
+** the cost per byte does not depend on the number of patterns.
+**
+** The automaton gets its own pass rather than being stepped from
+** lw_terminal_parser_read: the parser does not see every byte, as
+** control strings are skipped with memchr and lazy parsing may not
+** parse a chunk at all, while the automaton must. Chunks being read
+** 4KB at a time, the second pass runs over bytes still in cache, and
+** costs nothing when there is no stream pattern.
+**
+** Screen patterns (literals or POSIX extended regexes) are matched
+** against the rendered rows, and only against rows whose
+** line_generation moved since the pattern was last evaluated.
+**
+** Each match calls the optional callback, row is -1 for stream matches.
+*/
+
+#define VT100_EXPECT_STREAM 1
+#define VT100_EXPECT_SCREEN 2
+#define VT100_EXPECT_REGEX  4
+
+struct vt100_headless;
+
+typedef void (*vt100_expect_callback)(struct vt100_headless *this,
+                                      int id, int row, void *user_data);
+
+struct vt100_expect_pattern
+{
+    int                   flags;
+    int                   next; /* Next stream pattern with same literal */
+    int                   active;
+    int                   fresh; /* Not yet evaluated on the whole screen */
+    char                  *literal;
+    size_t                len;
+    regex_t               regex;
+    vt100_expect_callback callback;
+    void                  *user_data;
+};
+
+struct vt100_expect
+{
+    struct vt100_expect_pattern **patterns;
+    unsigned int                npatterns;
+    unsigned int                screen_patterns;
+    /* Aho-Corasick DFA over the active stream patterns */
+    int                         dirty;
+    int                         *delta;
+    int                         *output;
+    int                         *report;
+    int                         *link;
+    int                         nstates;
+    int                         state;
+    unsigned int                screen_generation;
+    int                         matched; /* First match since last reset */
+    int                         matched_row;
+};
+
+int vt100_headless_expect_add(struct vt100_headless *this,
+                              const char *pattern, size_t len, int flags,
+                              vt100_expect_callback callback,
+                              void *user_data);
+void vt100_headless_expect_remove(struct vt100_headless *this, int id);
+int vt100_headless_expect(struct vt100_headless *this, int timeout_ms);
+
+void vt100_expect_feed(struct vt100_headless *this,
+                       const char *buffer, size_t len);
+void vt100_expect_check_screen(struct vt100_headless *this);
+void vt100_expect_destroy(struct vt100_expect *this);
+
+#endif
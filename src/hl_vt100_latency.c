@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "hl_vt100_latency.h"
+
+void vt100_latency_add(struct vt100_latency *this, unsigned long usec)
+{
+    unsigned int bucket;
+
+    for (bucket = 0; bucket < VT100_LATENCY_BUCKETS - 1; ++bucket)
+        if (usec >> (bucket + 1) == 0)
+            break ;
+    this->buckets[bucket] += 1;
+    this->count += 1;
+    this->sum_usec += usec;
+    if (usec > this->max_usec)
+        this->max_usec = usec;
+}
+
+void vt100_latency_merge(struct vt100_latency *this,
+                         const struct vt100_latency *other)
+{
+    unsigned int bucket;
+
+    for (bucket = 0; bucket < VT100_LATENCY_BUCKETS; ++bucket)
+        this->buckets[bucket] += other->buckets[bucket];
+    this->count += other->count;
+    this->sum_usec += other->sum_usec;
+    if (other->max_usec > this->max_usec)
+        this->max_usec = other->max_usec;
+}
+
+/*
+** Returns the upper bound of the bucket holding the given percentile
+** (0 to 100), never more than the largest latency seen.
+*/
+unsigned long vt100_latency_percentile(const struct vt100_latency *this,
+                                       double percentile)
+{
+    unsigned long rank;
+    unsigned long seen;
+    unsigned int bucket;
+
+    if (this->count == 0)
+        return 0;
+    rank = (unsigned long)(this->count * percentile / 100);
+    if (rank >= this->count)
+        rank = this->count - 1;
+    seen = 0;
+    for (bucket = 0; bucket < VT100_LATENCY_BUCKETS; ++bucket)
+    {
+        seen += this->buckets[bucket];
+        if (seen > rank)
+            break ;
+    }
+    if (bucket >= VT100_LATENCY_BUCKETS - 1
+        || (2UL << bucket) - 1 > this->max_usec)
+        return this->max_usec;
+    return (2UL << bucket) - 1;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __VT100_HEADLESS_LATENCY_H__
+#define __VT100_HEADLESS_LATENCY_H__
+
+/*
+** Keystroke to screen latency.
+**
+** vt100_headless_write stamps the input it sends to the child, and the
+** next chunk fed to the emulator that changes a row or moves the
+** cursor closes the measure. Only the first input of a burst is
+** stamped, until the screen answers it.
+**
+** Bucket i counts latencies in [2^i, 2^(i+1)) microseconds, bucket 0
+** holds everything below 2us.
+*/
+
+#define VT100_LATENCY_BUCKETS 32
+
+struct vt100_latency
+{
+    unsigned long count;
+    unsigned long sum_usec;
+    unsigned long max_usec;
+    unsigned long buckets[VT100_LATENCY_BUCKETS];
+};
+
+void vt100_latency_add(struct vt100_latency *this, unsigned long usec);
+void vt100_latency_merge(struct vt100_latency *this,
+                         const struct vt100_latency *other);
+unsigned long vt100_latency_percentile(const struct vt100_latency *this,
+                                       double percentile);
+
+#endif
@@ -0,0 +1,580 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "hl_vt100.h"
+
+struct vt100_thread_metrics
+{
+    struct vt100_metrics        metrics;
+    struct vt100_thread_metrics *prev;
+    struct vt100_thread_metrics *next;
+};
+
+struct text
+{
+    char   *data;
+    size_t len;
+    size_t size;
+};
+
+struct metric
+{
+    const char *name;
+    const char *type;
+    const char *help;
+    double     (*get)(struct vt100_headless *this, unsigned long now);
+};
+
+static pthread_mutex_t             registry = PTHREAD_MUTEX_INITIALIZER;
+static struct vt100_headless       *sessions;
+static unsigned int                nsessions;
+static unsigned int                next_id;
+static struct vt100_thread_metrics *threads;
+static struct vt100_metrics        retired;
+static unsigned long               retired_hibernations;
+static unsigned long               retired_resumes;
+static unsigned long               retired_elided;
+static pthread_key_t               thread_key;
+static pthread_once_t              thread_key_once = PTHREAD_ONCE_INIT;
+
+/*
+** Counters are only written by the thread owning them, and read by the
+** one formatting the metrics: relaxed atomics are enough for them not to
+** tear.
+*/
+#define LOAD(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+#define ADD(counter, n) __atomic_add_fetch(&(counter), (n), __ATOMIC_RELAXED)
+
+static void add_metrics(struct vt100_metrics *to, struct vt100_metrics *from)
+{
+    to->bytes_read += LOAD(from->bytes_read);
+    to->reads += LOAD(from->reads);
+    to->parse_ns += LOAD(from->parse_ns);
+    to->changed += LOAD(from->changed);
+}
+
+static void add_counters(struct vt100_metrics *metrics, size_t len,
+                         unsigned long parse_ns, int changed)
+{
+    ADD(metrics->bytes_read, len);
+    ADD(metrics->reads, 1);
+    ADD(metrics->parse_ns, parse_ns);
+    ADD(metrics->changed, changed);
+}
+
+static void thread_exited(void *data)
+{
+    struct vt100_thread_metrics *block;
+
+    block = data;
+    pthread_mutex_lock(&registry);
+    add_metrics(&retired, &block->metrics);
+    if (block->prev != NULL)
+        block->prev->next = block->next;
+    else
+        threads = block->next;
+    if (block->next != NULL)
+        block->next->prev = block->prev;
+    pthread_mutex_unlock(&registry);
+    free(block);
+}
+
+static void create_thread_key(void)
+{
+    pthread_key_create(&thread_key, thread_exited);
+}
+
+static struct vt100_metrics *thread_metrics(void)
+{
+    struct vt100_thread_metrics *block;
+
+    pthread_once(&thread_key_once, create_thread_key);
+    block = pthread_getspecific(thread_key);
+    if (block != NULL)
+        return &block->metrics;
+    block = calloc(1, sizeof(*block));
+    if (block == NULL)
+        return NULL;
+    pthread_mutex_lock(&registry);
+    block->next = threads;
+    if (threads != NULL)
+        threads->prev = block;
+    threads = block;
+    pthread_mutex_unlock(&registry);
+    pthread_setspecific(thread_key, block);
+    return &block->metrics;
+}
+
+void vt100_metrics_register(struct vt100_headless *this)
+{
+    pthread_mutex_lock(&registry);
+    this->id = next_id++;
+    this->prev_session = NULL;
+    this->next_session = sessions;
+    if (sessions != NULL)
+        sessions->prev_session = this;
+    sessions = this;
+    nsessions += 1;
+    this->started_usec = this->last_output_usec = vt100_headless_now(this);
+    pthread_mutex_unlock(&registry);
+}
+
+void vt100_metrics_unregister(struct vt100_headless *this)
+{
+    pthread_mutex_lock(&registry);
+    if (this->prev_session != NULL)
+        this->prev_session->next_session = this->next_session;
+    else
+        sessions = this->next_session;
+    if (this->next_session != NULL)
+        this->next_session->prev_session = this->prev_session;
+    nsessions -= 1;
+    pthread_mutex_lock(&this->term->mutex);
+    retired_hibernations += this->term->hibernations;
+    retired_resumes += this->term->resumes;
+    retired_elided += this->term->elided;
+    pthread_mutex_unlock(&this->term->mutex);
+    pthread_mutex_unlock(&registry);
+}
+
+/*
+** Sets the pipeline of a session under the lock the metrics are read
+** with, so they never look at one being freed.
+*/
+void vt100_metrics_set_pipeline(struct vt100_headless *this,
+                                struct vt100_pipeline *pipeline)
+{
+    pthread_mutex_lock(&registry);
+    this->pipeline = pipeline;
+    pthread_mutex_unlock(&registry);
+}
+
+void vt100_metrics_account(struct vt100_headless *this, size_t len,
+                           unsigned long parse_ns, int changed)
+{
+    struct vt100_metrics *metrics;
+
+    add_counters(&this->metrics, len, parse_ns, changed);
+    __atomic_store_n(&this->last_output_usec, vt100_headless_now(this),
+                     __ATOMIC_RELAXED);
+    metrics = thread_metrics();
+    if (metrics != NULL)
+        add_counters(metrics, len, parse_ns, changed);
+}
+
+static double get_bytes_read(struct vt100_headless *this, unsigned long now)
+{
+    (void)now;
+    return LOAD(this->metrics.bytes_read);
+}
+
+static double get_reads(struct vt100_headless *this, unsigned long now)
+{
+    (void)now;
+    return LOAD(this->metrics.reads);
+}
+
+static double get_parse_seconds(struct vt100_headless *this,
+                                unsigned long now)
+{
+    (void)now;
+    return LOAD(this->metrics.parse_ns) / 1e9;
+}
+
+static double get_changed(struct vt100_headless *this, unsigned long now)
+{
+    (void)now;
+    return LOAD(this->metrics.changed);
+}
+
+static double get_reads_per_second(struct vt100_headless *this,
+                                   unsigned long now)
+{
+    if (now <= this->started_usec)
+        return 0;
+    return LOAD(this->metrics.reads) / ((now - this->started_usec) / 1e6);
+}
+
+static double get_average_chunk(struct vt100_headless *this,
+                                unsigned long now)
+{
+    unsigned long reads;
+
+    (void)now;
+    reads = LOAD(this->metrics.reads);
+    if (reads == 0)
+        return 0;
+    return (double)LOAD(this->metrics.bytes_read) / reads;
+}
+
+static double get_parse_per_megabyte(struct vt100_headless *this,
+                                     unsigned long now)
+{
+    unsigned long bytes_read;
+
+    (void)now;
+    bytes_read = LOAD(this->metrics.bytes_read);
+    if (bytes_read == 0)
+        return 0;
+    return LOAD(this->metrics.parse_ns) / 1e9 / (bytes_read / 1e6);
+}
+
+static double get_outbound_queue(struct vt100_headless *this,
+                                 unsigned long now)
+{
+    int master;
+    int queued;
+
+    (void)now;
+    master = LOAD(this->master);
+    if (master == -1 || ioctl(master, TIOCOUTQ, &queued) == -1)
+        return 0;
+    return queued;
+}
+
+static double get_since_output(struct vt100_headless *this,
+                               unsigned long now)
+{
+    unsigned long last_output_usec;
+
+    last_output_usec = LOAD(this->last_output_usec);
+    if (now <= last_output_usec)
+        return 0;
+    return (now - last_output_usec) / 1e6;
+}
+
+static double get_ring(struct vt100_headless *this, unsigned long now)
+{
+    (void)now;
+    if (this->pipeline == NULL)
+        return 0;
+    return vt100_pipeline_used(this->pipeline);
+}
+
+static double get_read_size(struct vt100_headless *this, unsigned long now)
+{
+    (void)now;
+    if (this->pipeline == NULL)
+        return 0;
+    return LOAD(this->pipeline->read_size);
+}
+
+static const struct metric session_metrics[] = {
+    {"vt100_session_bytes_read_total", "counter",
+     "Bytes read from the master.", get_bytes_read},
+    {"vt100_session_reads_total", "counter",
+     "Reads from the master that returned data.", get_reads},
+    {"vt100_session_parse_seconds_total", "counter",
+     "Time spent parsing.", get_parse_seconds},
+    {"vt100_session_changed_total", "counter",
+     "Calls to the changed callback.", get_changed},
+    {"vt100_session_reads_per_second", "gauge",
+     "Reads per second since the session started.", get_reads_per_second},
+    {"vt100_session_average_chunk_bytes", "gauge",
+     "Average size of the reads.", get_average_chunk},
+    {"vt100_session_parse_seconds_per_megabyte", "gauge",
+     "Parse time per MB read.", get_parse_per_megabyte},
+    {"vt100_session_outbound_queue_bytes", "gauge",
+     "Bytes written to the master not yet read by the child.",
+     get_outbound_queue},
+    {"vt100_session_seconds_since_output", "gauge",
+     "Time since the master last had something to read.", get_since_output},
+    {"vt100_session_ring_bytes", "gauge",
+     "Bytes read by the pipeline, waiting to be parsed.", get_ring},
+    {"vt100_session_read_size_bytes", "gauge",
+     "Size of the pipeline's next read.", get_read_size},
+    {NULL, NULL, NULL, NULL}
+};
+
+static void append(struct text *text, const char *format, ...)
+{
+    va_list ap;
+    size_t size;
+    char *data;
+    int len;
+
+    if (text->size - text->len < 512)
+    {
+        size = text->size ? text->size * 2 : 4096;
+        data = realloc(text->data, size);
+        if (data == NULL)
+            return ;
+        text->data = data;
+        text->size = size;
+    }
+    va_start(ap, format);
+    len = vsnprintf(text->data + text->len, text->size - text->len, format, ap);
+    va_end(ap);
+    if (len > 0 && (size_t)len < text->size - text->len)
+        text->len += len;
+}
+
+static void append_total(struct text *text, const char *name,
+                         const char *help, double value)
+{
+    append(text, "# HELP %s %s\n# TYPE %s counter\n%s %.15g\n",
+           name, help, name, name, value);
+}
+
+/*
+** Returns the metrics of every session and of the whole process, to be
+** freed by the caller.
+*/
+char *vt100_metrics_format(size_t *len)
+{
+    struct text text;
+    struct vt100_metrics total;
+    struct vt100_thread_metrics *block;
+    struct vt100_headless *session;
+    const struct metric *metric;
+    unsigned long hibernations;
+    unsigned long resumes;
+    unsigned long saved;
+    unsigned int sleeping;
+    unsigned long elided;
+    unsigned long pending;
+    unsigned long now;
+
+    memset(&text, 0, sizeof(text));
+    pthread_mutex_lock(&registry);
+    total = retired;
+    for (block = threads; block != NULL; block = block->next)
+        add_metrics(&total, &block->metrics);
+    append(&text, "# HELP vt100_sessions Live sessions.\n"
+           "# TYPE vt100_sessions gauge\nvt100_sessions %u\n", nsessions);
+    append_total(&text, "vt100_bytes_read_total",
+                 "Bytes read from all masters.", total.bytes_read);
+    append_total(&text, "vt100_reads_total",
+                 "Reads from all masters that returned data.", total.reads);
+    append_total(&text, "vt100_parse_seconds_total",
+                 "Time spent parsing.", total.parse_ns / 1e9);
+    append_total(&text, "vt100_changed_total",
+                 "Calls to the changed callback.", total.changed);
+    hibernations = retired_hibernations;
+    resumes = retired_resumes;
+    elided = retired_elided;
+    saved = sleeping = pending = 0;
+    for (session = sessions; session != NULL; session = session->next_session)
+    {
+        /* Written by the session's thread under the emulator's mutex */
+        pthread_mutex_lock(&session->term->mutex);
+        hibernations += session->term->hibernations;
+        resumes += session->term->resumes;
+        saved += session->term->hibernation_saved;
+        sleeping += session->term->hibernation != NULL;
+        elided += session->term->elided;
+        pending += session->term->pending_len;
+        pthread_mutex_unlock(&session->term->mutex);
+    }
+    append_total(&text, "vt100_hibernations_total",
+                 "Emulators put to sleep.", hibernations);
+    append_total(&text, "vt100_resumes_total",
+                 "Hibernating emulators woken up.", resumes);
+    append(&text, "# HELP vt100_hibernating_sessions Sessions asleep.\n"
+           "# TYPE vt100_hibernating_sessions gauge\n"
+           "vt100_hibernating_sessions %u\n", sleeping);
+    append(&text, "# HELP vt100_hibernation_saved_bytes Memory freed by"
+           " hibernating sessions.\n"
+           "# TYPE vt100_hibernation_saved_bytes gauge\n"
+           "vt100_hibernation_saved_bytes %lu\n", saved);
+    append_total(&text, "vt100_lazy_elided_bytes_total",
+                 "Output lazy parsing skimmed or dropped.", elided);
+    append(&text, "# HELP vt100_lazy_pending_bytes Output waiting to be"
+           " parsed.\n"
+           "# TYPE vt100_lazy_pending_bytes gauge\n"
+           "vt100_lazy_pending_bytes %lu\n", pending);
+    for (metric = session_metrics; metric->name != NULL; ++metric)
+    {
+        append(&text, "# HELP %s %s\n# TYPE %s %s\n", metric->name,
+               metric->help, metric->name, metric->type);
+        for (session = sessions; session != NULL;
+             session = session->next_session)
+        {
+            now = vt100_headless_now(session);
+            append(&text, "%s{session=\"%u\",pid=\"%d\"} %.15g\n",
+                   metric->name, session->id, (int)LOAD(session->child),
+                   metric->get(session, now));
+        }
+    }
+    pthread_mutex_unlock(&registry);
+    *len = text.len;
+    return text.data;
+}
+
+static int write_all(int fd, const char *data, size_t len)
+{
+    ssize_t written;
+
+    while (len > 0)
+    {
+        written = send(fd, data, len, MSG_NOSIGNAL);
+        if (written == -1 && errno == ENOTSOCK)
+            written = write(fd, data, len);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+                continue ;
+            return -1;
+        }
+        data += written;
+        len -= written;
+    }
+    return 0;
+}
+
+static void *serve(void *arg)
+{
+    char request[512];
+    char header[128];
+    struct pollfd pollfd;
+    char *text;
+    size_t len;
+    int listener;
+    int client;
+
+    listener = (int)(long)arg;
+    for (;;)
+    {
+        client = accept(listener, NULL, NULL);
+        if (client == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue ;
+            break ;
+        }
+        pollfd.fd = client;
+        pollfd.events = POLLIN;
+        header[0] = '\0';
+        text = vt100_metrics_format(&len);
+        if (poll(&pollfd, 1, 100) == 1
+            && read(client, request, sizeof(request)) >= 3
+            && memcmp(request, "GET", 3) == 0)
+            sprintf(header, "HTTP/1.0 200 OK\r\nContent-Type: text/plain;"
+                    " version=0.0.4\r\nContent-Length: %lu\r\n\r\n",
+                    (unsigned long)len);
+        if (write_all(client, header, strlen(header)) == 0 && text != NULL)
+            write_all(client, text, len);
+        free(text);
+        close(client);
+    }
+    close(listener);
+    return NULL;
+}
+
+int vt100_metrics_serve(const char *path)
+{
+    struct sockaddr_un addr;
+    pthread_t thread;
+    int listener;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener == -1)
+        return -1;
+    unlink(path);
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == -1
+        || listen(listener, 16) == -1
+        || pthread_create(&thread, NULL, serve, (void *)(long)listener) != 0)
+    {
+        close(listener);
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+struct metrics_file
+{
+    char         *path;
+    char         *tmp;
+    unsigned int interval;
+};
+
+static void *rewrite_file(void *arg)
+{
+    struct metrics_file *file;
+    char *text;
+    size_t len;
+    int written;
+    int fd;
+
+    file = arg;
+    for (;;)
+    {
+        text = vt100_metrics_format(&len);
+        fd = open(file->tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd != -1)
+        {
+            written = text != NULL && write_all(fd, text, len) == 0;
+            if (close(fd) == 0 && written)
+                rename(file->tmp, file->path);
+        }
+        free(text);
+        sleep(file->interval);
+    }
+    return NULL;
+}
+
+int vt100_metrics_write_file(const char *path, unsigned int interval)
+{
+    struct metrics_file *file;
+    pthread_t thread;
+
+    file = calloc(1, sizeof(*file));
+    if (file == NULL)
+        return -1;
+    file->path = malloc(strlen(path) + 1);
+    file->tmp = malloc(strlen(path) + 5);
+    if (file->path == NULL || file->tmp == NULL)
+        goto fail;
+    strcpy(file->path, path);
+    sprintf(file->tmp, "%s.tmp", path);
+    file->interval = interval ? interval : 1;
+    if (pthread_create(&thread, NULL, rewrite_file, file) != 0)
+        goto fail;
+    pthread_detach(thread);
+    return 0;
+fail:
+    free(file->path);
+    free(file->tmp);
+    free(file);
+    return -1;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __VT100_HEADLESS_METRICS_H__
+#define __VT100_HEADLESS_METRICS_H__
+
+#include <stddef.h>
+
+/*
+** I/O metrics of headless sessions, in Prometheus text format.
+**
+** Each session counts what it reads and parses in its own struct
+** vt100_metrics, only ever written by the thread driving it. The same
+** numbers are added to a block private to that thread, and all the
+** thread blocks (plus those of threads that exited) are summed when
+** the metrics are formatted, so updating them needs no lock: having a
+** single writer, they are relaxed atomic adds, only there for the
+** formatting thread not to read torn values.
+**
+** vt100_metrics_serve answers every connection on a Unix socket with
+** the current metrics (with an HTTP header if the client sent a GET),
+** vt100_metrics_write_file rewrites a file every interval seconds,
+** atomically, for the node_exporter textfile collector. Both run in a
+** thread of their own.
+*/
+
+struct vt100_headless;
+struct vt100_pipeline;
+
+struct vt100_metrics
+{
+    unsigned long bytes_read;
+    unsigned long reads;
+    unsigned long parse_ns;
+    unsigned long changed;
+};
+
+void vt100_metrics_register(struct vt100_headless *this);
+void vt100_metrics_unregister(struct vt100_headless *this);
+void vt100_metrics_set_pipeline(struct vt100_headless *this,
+                                struct vt100_pipeline *pipeline);
+void vt100_metrics_account(struct vt100_headless *this, size_t len,
+                           unsigned long parse_ns, int changed);
+char *vt100_metrics_format(size_t *len);
+int vt100_metrics_serve(const char *path);
+int vt100_metrics_write_file(const char *path, unsigned int interval);
+
+#endif
@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include "hl_vt100.h"
+
+static void signal_fd(int fd)
+{
+    uint64_t one;
+
+    one = 1;
+    while (write(fd, &one, sizeof(one)) == -1 && errno == EINTR)
+        ;
+}
+
+static void clear_fd(int fd)
+{
+    uint64_t count;
+
+    while (read(fd, &count, sizeof(count)) == -1 && errno == EINTR)
+        ;
+}
+
+size_t vt100_pipeline_used(struct vt100_pipeline *this)
+{
+    return __atomic_load_n(&this->head, __ATOMIC_ACQUIRE)
+        - __atomic_load_n(&this->tail, __ATOMIC_ACQUIRE);
+}
+
+/*
+** Waits until the parser made room, returns 0 if asked to stop.
+** waiting and tail are both sequentially consistent, so either the
+** parser sees waiting set after moving tail, or we see tail moved.
+*/
+static int wait_for_room(struct vt100_pipeline *this, size_t head)
+{
+    struct pollfd pollfd;
+
+    this->full += 1;
+    __atomic_store_n(&this->waiting, 1, __ATOMIC_SEQ_CST);
+    while (head - __atomic_load_n(&this->tail, __ATOMIC_SEQ_CST) == this->size
+           && !__atomic_load_n(&this->stop, __ATOMIC_ACQUIRE))
+    {
+        pollfd.fd = this->room_fd;
+        pollfd.events = POLLIN;
+        if (poll(&pollfd, 1, -1) == 1)
+            clear_fd(this->room_fd);
+    }
+    __atomic_store_n(&this->waiting, 0, __ATOMIC_SEQ_CST);
+    return !__atomic_load_n(&this->stop, __ATOMIC_ACQUIRE);
+}
+
+/*
+** The I/O thread: reads straight into the ring until the master hangs
+** up or the pipeline is stopped.
+*/
+static void *pipeline_run(void *data)
+{
+    struct vt100_pipeline *this;
+    struct pollfd fds[2];
+    size_t offset;
+    size_t head;
+    size_t used;
+    size_t len;
+    ssize_t got;
+
+    this = data;
+    head = this->head;
+    while (!__atomic_load_n(&this->stop, __ATOMIC_ACQUIRE))
+    {
+        used = head - __atomic_load_n(&this->tail, __ATOMIC_ACQUIRE);
+        if (used == this->size)
+        {
+            if (!wait_for_room(this, head))
+                break ;
+            continue ;
+        }
+        fds[0].fd = this->master;
+        fds[0].events = POLLIN;
+        fds[1].fd = this->room_fd;
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, -1) == -1)
+            continue ;
+        if (fds[1].revents)
+            clear_fd(this->room_fd);
+        if (fds[0].revents == 0)
+            continue ;
+        offset = head & (this->size - 1);
+        len = this->size - used;
+        if (len > this->size - offset)
+            len = this->size - offset;
+        if (len > this->read_size)
+            len = this->read_size;
+        if (this->capture != NULL)
+            got = vt100_capture_read(this->capture, this->master,
+                                     this->ring + offset, len);
+        else
+            got = read(this->master, this->ring + offset, len);
+        if (got <= 0)
+        {
+            if (got == -1 && (errno == EINTR || errno == EAGAIN))
+                continue ;
+            /* EOF or EIO: every slave fd is gone, nothing more will come */
+            __atomic_store_n(&this->eof, 1, __ATOMIC_RELEASE);
+            signal_fd(this->data_fd);
+            break ;
+        }
+        head += got;
+        __atomic_store_n(&this->head, head, __ATOMIC_RELEASE);
+        signal_fd(this->data_fd);
+        this->reads += 1;
+        /* read_size is also read by the metrics thread */
+        if ((size_t)got == this->read_size
+            && this->read_size < VT100_PIPELINE_MAX_READ)
+            __atomic_store_n(&this->read_size, this->read_size * 2,
+                             __ATOMIC_RELAXED);
+        else if ((size_t)got < this->read_size / 4
+                 && this->read_size > VT100_PIPELINE_MIN_READ)
+            __atomic_store_n(&this->read_size, this->read_size / 2,
+                             __ATOMIC_RELAXED);
+        if (used + got > this->high_water)
+            this->high_water = used + got;
+    }
+    return NULL;
+}
+
+/*
+** Starts reading the master from an I/O thread, into a ring of
+** ring_size bytes (VT100_PIPELINE_RING if 0, rounded up to a power of
+** two). Returns 0, or -1 if there is no master or resources are short.
+*/
+int vt100_headless_pipeline_start(struct vt100_headless *this,
+                                  size_t ring_size)
+{
+    struct vt100_pipeline *pipeline;
+    size_t size;
+
+    if (this->pipeline != NULL)
+        return 0;
+    if (this->master == -1 || this->master_closed)
+        return -1;
+    if (ring_size == 0)
+        ring_size = VT100_PIPELINE_RING;
+    for (size = VT100_PIPELINE_MIN_READ; size < ring_size; size *= 2)
+        ;
+    pipeline = calloc(1, sizeof(*pipeline));
+    if (pipeline == NULL)
+        return -1;
+    pipeline->ring = malloc(size);
+    if (pipeline->ring == NULL)
+        goto free_pipeline;
+    pipeline->size = size;
+    pipeline->read_size = VT100_PIPELINE_MIN_READ;
+    pipeline->master = this->master;
+    pipeline->capture = this->capture;
+    pipeline->data_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (pipeline->data_fd == -1)
+        goto free_ring;
+    pipeline->room_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (pipeline->room_fd == -1)
+        goto close_data_fd;
+    if (pthread_create(&pipeline->thread, NULL, pipeline_run, pipeline) != 0)
+        goto close_room_fd;
+    vt100_metrics_set_pipeline(this, pipeline);
+    return 0;
+close_room_fd:
+    close(pipeline->room_fd);
+close_data_fd:
+    close(pipeline->data_fd);
+free_ring:
+    free(pipeline->ring);
+free_pipeline:
+    free(pipeline);
+    return -1;
+}
+
+/*
+** Stops the I/O thread and parses what it queued, the master being
+** read directly again from then on.
+*/
+void vt100_headless_pipeline_stop(struct vt100_headless *this)
+{
+    struct vt100_pipeline *pipeline;
+
+    pipeline = this->pipeline;
+    if (pipeline == NULL)
+        return ;
+    __atomic_store_n(&pipeline->stop, 1, __ATOMIC_RELEASE);
+    signal_fd(pipeline->room_fd);
+    pthread_join(pipeline->thread, NULL);
+    while (vt100_headless_pipeline_drain(this) > 0)
+        ;
+    vt100_metrics_set_pipeline(this, NULL);
+    close(pipeline->room_fd);
+    close(pipeline->data_fd);
+    free(pipeline->ring);
+    free(pipeline);
+}
+
+/*
+** Parses what the I/O thread queued, one contiguous stretch of the ring
+** at a time, at most a ring's worth so a chatty child can't starve the
+** caller. Chunks are recorded as they get parsed.
+** Returns the number of bytes parsed, 0 if there was nothing, -1 once
+** the master hung up and everything was parsed.
+*/
+int vt100_headless_pipeline_drain(struct vt100_headless *this)
+{
+    struct vt100_pipeline *pipeline;
+    size_t offset;
+    size_t total;
+    size_t head;
+    size_t tail;
+    size_t len;
+    int eof;
+
+    pipeline = this->pipeline;
+    clear_fd(pipeline->data_fd);
+    total = 0;
+    while (total < pipeline->size)
+    {
+        /* eof first: once set, head is final */
+        eof = __atomic_load_n(&pipeline->eof, __ATOMIC_ACQUIRE);
+        head = __atomic_load_n(&pipeline->head, __ATOMIC_ACQUIRE);
+        tail = pipeline->tail;
+        if (head == tail)
+        {
+            if (!eof)
+                break ;
+            this->master_closed = 1;
+            vt100_headless_reap(this, 0);
+            return total > 0 ? (int)total : -1;
+        }
+        offset = tail & (pipeline->size - 1);
+        len = head - tail;
+        if (len > pipeline->size - offset)
+            len = pipeline->size - offset;
+        if (this->record != NULL
+            && vt100_record_chunk(this->record, vt100_headless_now(this),
+                                  pipeline->ring + offset, len) == -1)
+            this->record_error = this->record->error;
+        vt100_headless_feed(this, pipeline->ring + offset, len);
+        pipeline->batches += 1;
+        __atomic_store_n(&pipeline->tail, tail + len, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&pipeline->waiting, __ATOMIC_SEQ_CST))
+            signal_fd(pipeline->room_fd);
+        total += len;
+    }
+    return total;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __VT100_HEADLESS_PIPELINE_H__
+#define __VT100_HEADLESS_PIPELINE_H__
+
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+** Optional read and parse pipeline of a headless session.
+**
+** Once vt100_headless_pipeline_start is called, an I/O thread reads
+** the master into a ring of bytes, which the thread driving the
+** session (through vt100_headless_poll or vt100_headless_pump, or its
+** own event loop polling vt100_headless_fd) parses in batches of
+** everything queued. The child then keeps writing while the previous
+** output is parsed, instead of waiting for each 4KB read to be parsed.
+**
+** The ring has a single producer and a single consumer: head is only
+** written by the I/O thread, tail by the parser, so neither needs a
+** lock. Reads start at VT100_PIPELINE_MIN_READ bytes and double each
+** time one fills its buffer, up to VT100_PIPELINE_MAX_READ, halving
+** back when they come back mostly empty (Linux PTYs hand out at most
+** 4KB per read though, so there they stay small). When the ring is
+** full the I/O thread waits for the parser to make room, which
+** throttles the child through the PTY as before.
+**
+** Everything but head, tail, eof and waiting is written by one side
+** only and read by the other for statistics, which may be stale.
+*/
+
+#define VT100_PIPELINE_RING     (1024 * 1024)
+#define VT100_PIPELINE_MIN_READ 4096
+#define VT100_PIPELINE_MAX_READ (256 * 1024)
+
+struct vt100_headless;
+struct vt100_capture;
+
+struct vt100_pipeline
+{
+    char          *ring;
+    size_t        size; /* A power of two */
+    size_t        head; /* Bytes ever queued */
+    size_t        tail; /* Bytes ever parsed */
+    size_t        read_size;
+    size_t        high_water; /* Largest occupancy seen */
+    unsigned long reads;
+    unsigned long batches;
+    unsigned long full; /* Times the I/O thread waited for room */
+    int           eof;
+    int           waiting; /* The I/O thread waits for room */
+    int           stop;
+    int           master;
+    struct vt100_capture *capture; /* The session's, NULL if none */
+    int           data_fd; /* eventfd, readable when there is data */
+    int           room_fd; /* eventfd, readable when there is room */
+    pthread_t     thread;
+};
+
+int vt100_headless_pipeline_start(struct vt100_headless *this,
+                                  size_t ring_size);
+void vt100_headless_pipeline_stop(struct vt100_headless *this);
+int vt100_headless_pipeline_drain(struct vt100_headless *this);
+size_t vt100_pipeline_used(struct vt100_pipeline *this);
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "vt100_ingest.h"
+
+/*
+** Prints screens out of terminal logs, see vt100_ingest.h.
+*/
+
+static const char *reasons[] = {"", "every", "clear", "", "end"};
+
+static void print_snapshot(struct vt100_ingest *ingest,
+                           struct lw_terminal_vt100 *vt100, int reason)
+{
+    const char **lines;
+    unsigned int y;
+    unsigned int len;
+
+    printf("--- %s frame %lu (%s)\n", (char *)ingest->user_data,
+           ingest->frames, reasons[reason]);
+    lines = lw_terminal_vt100_getlines(vt100);
+    for (y = 0; y < vt100->height; ++y)
+    {
+        for (len = vt100->width; len > 0 && lines[y][len - 1] == ' '; --len)
+            ;
+        fwrite(lines[y], 1, len, stdout);
+        putchar('\n');
+    }
+}
+
+static enum vt100_ingest_format parse_format(const char *name)
+{
+    if (strcmp(name, "raw") == 0)
+        return VT100_INGEST_RAW;
+    if (strcmp(name, "ttyrec") == 0)
+        return VT100_INGEST_TTYREC;
+    if (strcmp(name, "asciicast") == 0)
+        return VT100_INGEST_ASCIICAST;
+    if (strcmp(name, "vt1r") == 0)
+        return VT100_INGEST_RECORD;
+    return VT100_INGEST_AUTO;
+}
+
+int main(int ac, char **av)
+{
+    static char output[1 << 16];
+    struct vt100_ingest ingest;
+    struct lw_terminal_vt100 *vt100;
+    struct timespec start;
+    struct timespec end;
+    unsigned long bytes;
+    double seconds;
+    int status;
+    int opt;
+
+    memset(&ingest, 0, sizeof(ingest));
+    ingest.snapshot = print_snapshot;
+    ingest.snapshot_on = VT100_SNAPSHOT_END;
+    while ((opt = getopt(ac, av, "f:n:cq")) != -1)
+    {
+        switch (opt)
+        {
+        case 'f': ingest.format = parse_format(optarg); break ;
+        case 'n':
+            ingest.every_frames = strtoul(optarg, NULL, 10);
+            ingest.snapshot_on |= VT100_SNAPSHOT_EVERY;
+            break ;
+        case 'c': ingest.snapshot_on |= VT100_SNAPSHOT_CLEAR; break ;
+        case 'q': ingest.snapshot = NULL; break ;
+        default: goto usage;
+        }
+    }
+    if (optind == ac)
+        goto usage;
+    setvbuf(stdout, output, _IOFBF, sizeof(output));
+    status = EXIT_SUCCESS;
+    bytes = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (; optind < ac; ++optind)
+    {
+        vt100 = lw_terminal_vt100_init(NULL, lw_terminal_parser_default_unimplemented);
+        if (vt100 == NULL)
+            return EXIT_FAILURE;
+        ingest.user_data = av[optind];
+        ingest.frames = ingest.bytes = 0;
+        if (vt100_ingest_file(&ingest, vt100, av[optind]) == -1)
+        {
+            fprintf(stderr, "%s: unreadable, truncated or corrupted\n",
+                    av[optind]);
+            status = EXIT_FAILURE;
+        }
+        bytes += ingest.bytes;
+        lw_terminal_vt100_destroy(vt100);
+    }
+    fflush(stdout);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "%lu bytes in %.3fs, %.2f MB/s\n", bytes, seconds,
+            seconds > 0 ? bytes / seconds / 1e6 : 0);
+    vt100_ingest_release(&ingest);
+    return status;
+usage:
+    fprintf(stderr, "Usage: %s [-f raw|ttyrec|asciicast|vt1r] [-n FRAMES] [-c] [-q]"
+            " FILE...\n", av[0]);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include "hl_vt100.h"
+
+/*
+** Measures keystroke to screen latency.
+**
+** Usage: latency [-n SESSIONS] [-k KEYSTROKES] [-s KEYS] [-i MS]
+**                [-w MS] PROGRAM [ARGS...]
+**
+** Starts SESSIONS copies of PROGRAM, waits -w milliseconds for them to
+** settle, then types KEYSTROKES keys in each, cycling through KEYS,
+** one key at a time: the next one is sent -i milliseconds after the
+** screen answered the previous one. A key the screen does not answer
+** within a second is counted as lost.
+**
+**     latency cat
+**     latency -n 16 sh -c 'while read -r l; do echo "$l"; done'
+**     latency -s jjjjkkkk vi /etc/services
+**
+** Every session runs in the same poll(2) loop, pumped without ever
+** blocking, so the figures include the time a busy reactor makes
+** the others wait.
+*/
+
+#define LOST_AFTER_USEC 1000000
+
+struct session
+{
+    struct vt100_headless *vt100;
+    unsigned long         sent;
+    unsigned long         lost;
+    unsigned long         next_usec;
+    int                   hung_up;
+};
+
+static void print_latency(const char *name, struct vt100_latency *latency,
+                          unsigned long lost)
+{
+    printf("%s: %lu answered, %lu lost, us: avg %lu p50 %lu p90 %lu"
+           " p99 %lu max %lu\n", name, latency->count, lost,
+           latency->count ? latency->sum_usec / latency->count : 0,
+           vt100_latency_percentile(latency, 50),
+           vt100_latency_percentile(latency, 90),
+           vt100_latency_percentile(latency, 99),
+           latency->max_usec);
+}
+
+/*
+** Sends the session its next key when it's time, returns 0 once it
+** has nothing left to send nor to wait for.
+*/
+static int type(struct session *session, const char *keys,
+                unsigned long keystrokes, unsigned long interval_usec)
+{
+    struct vt100_headless *vt100;
+    unsigned long now;
+
+    vt100 = session->vt100;
+    now = vt100_headless_now(vt100);
+    if (vt100->input_usec != 0)
+    {
+        if (now - vt100->input_usec < LOST_AFTER_USEC)
+            return 1;
+        vt100->input_usec = 0;
+        session->lost += 1;
+        session->next_usec = now;
+    }
+    if (session->hung_up || session->sent == keystrokes)
+        return 0;
+    if (now < session->next_usec)
+        return 1;
+    if (vt100_headless_write(vt100, keys + session->sent % strlen(keys),
+                             1) != 1)
+    {
+        session->hung_up = 1;
+        vt100->input_usec = 0;
+        return 0;
+    }
+    session->sent += 1;
+    session->next_usec = now + interval_usec;
+    return 1;
+}
+
+int main(int ac, char **av)
+{
+    struct session *sessions;
+    struct pollfd *fds;
+    struct vt100_latency all;
+    unsigned long nsessions;
+    unsigned long keystrokes;
+    unsigned long interval_usec;
+    unsigned long warmup_usec;
+    unsigned long lost;
+    unsigned long i;
+    const char *keys;
+    char name[64];
+    int busy;
+    int opt;
+
+    nsessions = 1;
+    keystrokes = 1000;
+    keys = "abcdefghijklmnopqrstuvwxyz\r";
+    interval_usec = 0;
+    warmup_usec = 200000;
+    while ((opt = getopt(ac, av, "+n:k:s:i:w:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n': nsessions = strtoul(optarg, NULL, 10); break ;
+        case 'k': keystrokes = strtoul(optarg, NULL, 10); break ;
+        case 's': keys = optarg; break ;
+        case 'i': interval_usec = strtoul(optarg, NULL, 10) * 1000; break ;
+        case 'w': warmup_usec = strtoul(optarg, NULL, 10) * 1000; break ;
+        default: goto usage;
+        }
+    }
+    if (optind == ac || nsessions == 0 || *keys == '\0')
+        goto usage;
+    sessions = calloc(nsessions, sizeof(*sessions));
+    fds = calloc(nsessions, sizeof(*fds));
+    if (sessions == NULL || fds == NULL)
+        return EXIT_FAILURE;
+    for (i = 0; i < nsessions; ++i)
+    {
+        sessions[i].vt100 = new_vt100_headless();
+        if (sessions[i].vt100 == NULL)
+            return EXIT_FAILURE;
+        sessions[i].vt100->detached = 1;
+        vt100_headless_fork(sessions[i].vt100, av[optind], av + optind);
+        sessions[i].next_usec = vt100_headless_now(sessions[i].vt100)
+            + warmup_usec;
+        fds[i].fd = sessions[i].vt100->master;
+        fds[i].events = POLLIN;
+    }
+    do
+    {
+        busy = 0;
+        for (i = 0; i < nsessions; ++i)
+            busy |= type(&sessions[i], keys, keystrokes, interval_usec);
+        if (poll(fds, nsessions, 1) > 0)
+            for (i = 0; i < nsessions; ++i)
+                if (fds[i].revents
+                    && vt100_headless_pump(sessions[i].vt100) == -1)
+                {
+                    fds[i].fd = -1;
+                    sessions[i].hung_up = 1;
+                }
+    } while (busy);
+    memset(&all, 0, sizeof(all));
+    lost = 0;
+    for (i = 0; i < nsessions; ++i)
+    {
+        sprintf(name, "session %lu (pid %d)", i,
+                (int)sessions[i].vt100->child);
+        print_latency(name, &sessions[i].vt100->latency, sessions[i].lost);
+        vt100_latency_merge(&all, &sessions[i].vt100->latency);
+        lost += sessions[i].lost;
+        if (!sessions[i].vt100->child_exited)
+            kill(sessions[i].vt100->child, SIGHUP);
+        delete_vt100_headless(sessions[i].vt100);
+    }
+    if (nsessions > 1)
+        print_latency("all", &all, lost);
+    return EXIT_SUCCESS;
+usage:
+    fprintf(stderr, "Usage: %s [-n SESSIONS] [-k KEYSTROKES] [-s KEYS]"
+            " [-i MS] [-w MS] PROGRAM [ARGS...]\n", av[0]);
+    return EXIT_FAILURE;
+}
@@ -28,170 +28,59 @@
 #    include <stdio.h>
 #endif
 
-#include "lw_terminal_parser.h"
+#include <string.h>
 
-static void lw_terminal_parser_push(struct lw_terminal *this, char c)
-{
-    if (this->stack_ptr >= TERM_STACK_SIZE)
-        return ;
-    this->stack[this->stack_ptr++] = c;
-}
+#include "lw_terminal_parser.h"
 
-static void lw_terminal_parser_parse_params(struct lw_terminal *this)
-{
-    unsigned int i;
-    int got_something;
+static int lw_terminal_parser_call(struct lw_terminal *this,
+                                   enum lw_terminal_stats_kind kind, char c);
 
-    got_something = 0;
-    this->argc = 0;
-    this->argv[0] = 0;
-    for (i = 0; i < this->stack_ptr; ++i)
-    {
-        if (this->stack[i] >= '0' && this->stack[i] <= '9')
-        {
-            got_something = 1;
-            this->argv[this->argc] = this->argv[this->argc] * 10
-                + this->stack[i] - '0';
-        }
-        else if (this->stack[i] == ';')
-        {
-            got_something = 0;
-            this->argc += 1;
-            this->argv[this->argc] = 0;
-        }
-    }
-    this->argc += got_something;
-}
+#define LW_TERMINAL_PARSER_READ lw_terminal_parser_read_char
+#define LW_TERMINAL_PARSER_READ_BUF lw_terminal_parser_read_chars
+#define LW_TERMINAL_PARSER_WRITE(this, c) (this)->write(this, c)
+#define LW_TERMINAL_PARSER_CALL(this, kind, c) \
+    lw_terminal_parser_call(this, kind, c)
+#include "lw_terminal_parser_template.h"
 
-static void lw_terminal_parser_call_CSI(struct lw_terminal *this, char c)
-{
-    lw_terminal_parser_parse_params(this);
-    if (((term_action *)&this->callbacks.csi)[c - '0'] == NULL)
-    {
-        if (this->unimplemented != NULL)
-            this->unimplemented(this, "CSI", c);
-        goto leave;
-    }
-    ((term_action *)&this->callbacks.csi)[c - '0'](this);
-leave:
-    this->state = INIT;
-    this->flag = '\0';
-    this->stack_ptr = 0;
-    this->argc = 0;
-}
-
-static void lw_terminal_parser_call_ESC(struct lw_terminal *this, char c)
-{
-    if (((term_action *)&this->callbacks.esc)[c - '0'] == NULL)
-    {
-        if (this->unimplemented != NULL)
-            this->unimplemented(this, "ESC", c);
-        goto leave;
-    }
-    ((term_action *)&this->callbacks.esc)[c - '0'](this);
-leave:
-    this->state = INIT;
-    this->stack_ptr = 0;
-    this->argc = 0;
-}
-
-static void lw_terminal_parser_call_HASH(struct lw_terminal *this, char c)
+/*
+** Runs the action bound in the callbacks, if any.
+*/
+static int lw_terminal_parser_call(struct lw_terminal *this,
+                                   enum lw_terminal_stats_kind kind, char c)
 {
-    if (((term_action *)&this->callbacks.hash)[c - '0'] == NULL)
-    {
-        if (this->unimplemented != NULL)
-            this->unimplemented(this, "HASH", c);
-        goto leave;
-    }
-    ((term_action *)&this->callbacks.hash)[c - '0'](this);
-leave:
-    this->state = INIT;
-    this->stack_ptr = 0;
-    this->argc = 0;
-}
+    const struct ascii_callbacks *table;
+    term_action action;
 
-static void lw_terminal_parser_call_GSET(struct lw_terminal *this, char c)
-{
-    if (c < '0' || c > 'B'
-        || ((term_action *)&this->callbacks.scs)[c - '0'] == NULL)
-    {
-        if (this->unimplemented != NULL)
-            this->unimplemented(this, "GSET", c);
-        goto leave;
-    }
-    ((term_action *)&this->callbacks.scs)[c - '0'](this);
-leave:
-    this->state = INIT;
-    this->stack_ptr = 0;
-    this->argc = 0;
+    if (kind == STATS_CSI)
+        table = &this->cb->csi;
+    else if (kind == STATS_HASH)
+        table = &this->cb->hash;
+    else if (kind == STATS_SCS)
+        table = &this->cb->scs;
+    else
+        table = &this->cb->esc;
+    action = ((const term_action *)table)[c - '0'];
+    if (action == NULL)
+        return 0;
+    LW_TERMINAL_PARSER_DISPATCH(this, kind, c, action);
+    return 1;
 }
 
-/*
-** INIT
-**  \_ ESC "\033"
-**  |   \_ CSI   "\033["
-**  |   |   \_ c == '?' : term->flag = '?'
-**  |   |   \_ c == ';' || (c >= '0' && c <= '9') : term_push
-**  |   |   \_ else : term_call_CSI()
-**  |   \_ HASH  "\033#"
-**  |   |   \_ term_call_hash()
-**  |   \_ G0SET "\033("
-**  |   |   \_ term_call_GSET()
-**  |   \_ G1SET "\033)"
-**  |   |   \_ term_call_GSET()
-**  \_ term->write()
-*/
 void lw_terminal_parser_read(struct lw_terminal *this, char c)
 {
-    if (this->state == INIT)
-    {
-        if (c == '\033')
-            this->state = ESC;
-        else
-            this->write(this, c);
-    }
-    else if (this->state == ESC)
-    {
-        if (c == '[')
-            this->state = CSI;
-        else if (c == '#')
-            this->state = HASH;
-        else if (c == '(')
-            this->state = G0SET;
-        else if (c == ')')
-            this->state = G1SET;
-        else if (c >= '0' && c <= 'z')
-            lw_terminal_parser_call_ESC(this, c);
-        else this->write(this, c);
-    }
-    else if (this->state == HASH)
-    {
-        if (c >= '0' && c <= '9')
-            lw_terminal_parser_call_HASH(this, c);
-        else
-            this->write(this, c);
-    }
-    else if (this->state == G0SET || this->state == G1SET)
-    {
-        lw_terminal_parser_call_GSET(this, c);
-    }
-    else if (this->state == CSI)
-    {
-        if (c == '?')
-            this->flag = '?';
-        else if (c == ';' || (c >= '0' && c <= '9'))
-            lw_terminal_parser_push(this, c);
-        else if (c >= '?' && c <= 'z')
-            lw_terminal_parser_call_CSI(this, c);
-        else
-            this->write(this, c);
-    }
+    lw_terminal_parser_read_char(this, c);
 }
 
 void lw_terminal_parser_read_str(struct lw_terminal *this, char *c)
 {
     while (*c)
-        lw_terminal_parser_read(this, *c++);
+        lw_terminal_parser_read_char(this, *c++);
+}
+
+void lw_terminal_parser_read_buf(struct lw_terminal *this,
+                                 const char *buffer, size_t len)
+{
+    lw_terminal_parser_read_chars(this, buffer, len);
 }
 
 #ifndef NDEBUG
@@ -217,12 +106,62 @@ void lw_terminal_parser_default_unimplemented(struct lw_terminal* this, char *se
 }
 #endif
 
+struct lw_terminal *lw_terminal_parser_init_at(void *memory)
+{
+    struct lw_terminal *this;
+
+    this = memset(memory, 0, sizeof(struct lw_terminal));
+    this->cb = &this->callbacks;
+#ifdef LW_TERMINAL_STATS
+    this->stats = calloc(1, sizeof(*this->stats));
+    if (this->stats == NULL)
+        return NULL;
+#endif
+    return this;
+}
+
 struct lw_terminal *lw_terminal_parser_init(void)
 {
-    return calloc(1, sizeof(struct lw_terminal));
+    struct lw_terminal *this;
+
+    this = malloc(sizeof(struct lw_terminal));
+    if (this == NULL)
+        return NULL;
+    if (lw_terminal_parser_init_at(this) == NULL)
+    {
+        free(this);
+        return NULL;
+    }
+    return this;
+}
+
+/*
+** Drops any sequence being parsed, statistics are kept.
+*/
+void lw_terminal_parser_reset(struct lw_terminal *this)
+{
+    this->state = INIT;
+    this->got_something = 0;
+    this->argc = 0;
+    this->flag = '\0';
+}
+
+int lw_terminal_parser_stats(struct lw_terminal *this,
+                             struct lw_terminal_stats *stats)
+{
+    if (this->stats == NULL)
+        return -1;
+    memcpy(stats, this->stats, sizeof(*stats));
+    return 0;
+}
+
+void lw_terminal_parser_destroy_at(struct lw_terminal *this)
+{
+    free(this->stats);
 }
 
 void lw_terminal_parser_destroy(struct lw_terminal* this)
 {
+    lw_terminal_parser_destroy_at(this);
     free(this);
 }
@@ -66,6 +66,11 @@
 ** struct term_callbacks callbacks :
 **    Hooks for your callbacks to recieve escape sequences
 **
+** const struct term_callbacks *cb :
+**    The callbacks actually used, &callbacks by default. Many parsers
+**    for the same implementation can point it to one table filled once
+**    instead of filling their own.
+**
 ** enum term_state state :
 **     During a callback, typically a scs, you can read here if it's a
 **     G1SET or a G0SET
@@ -78,6 +83,9 @@
 **     For your callbacks, parameters of escape sequences are accessible
 **     here.
 **     \033[42;43m will have 2 in argc and argv[0] = 42, argv[1] = 43
+**     Untrusted output can't make them grow: only the first
+**     TERM_STACK_SIZE parameters are kept, and values saturate at
+**     TERM_PARAM_MAX.
 **
 ** char flag;
 **     Optinal constructor flag present before parameters, like in :
@@ -88,6 +96,48 @@
 **     Can be NULL, you can hook here to know where the terminal parses an
 **     escape sequence on which you have not registered a callback.
 **
+** void (*string)(struct lw_terminal *, enum lw_terminal_string_kind kind,
+**                const char *chunk, size_t len, int final) :
+** unsigned int string_kinds :
+**     Can be NULL, gets the payload of the control strings whose kind
+**     bit (1 << kind) is set in string_kinds: OSC "\033]", DCS
+**     "\033P", APC "\033_", PM "\033^" and SOS "\033X", ended by ST
+**     "\033\\", or BEL for OSC. The payload comes in chunks as it is
+**     read, pointing in the buffer given to lw_terminal_parser_read_buf,
+**     and nothing is kept: final is set on the last call, with an
+**     empty chunk. An ESC not followed by a backslash ends a string
+**     too, starting a new sequence. Other strings are skipped, at
+**     memchr speed when read by lw_terminal_parser_read_buf.
+**
+** Placement
+** =========
+**
+** lw_terminal_parser_init_at sets a parser up in sizeof(struct
+** lw_terminal) bytes of memory given by the caller, so it can live in
+** a larger allocation. Such a parser is released with
+** lw_terminal_parser_destroy_at, which leaves the memory alone.
+** lw_terminal_parser_reset drops any sequence being parsed.
+**
+** Instrumentation
+** ===============
+**
+** When built with LW_TERMINAL_STATS defined (make STATS=1), the parser
+** counts every dispatched final byte per kind of sequence, every char
+** given to write, unimplemented sequences and parameters dropped
+** because argv was full. One dispatch out of
+** LW_TERMINAL_STATS_SAMPLE is timed, its duration in nanoseconds
+** going to bucket floor(log2(ns)) of a histogram per final byte.
+** lw_terminal_parser_stats copies all of it, it returns -1 when the
+** instrumentation is not built in.
+**
+** Specialization
+** ==============
+**
+** The state machine lives in lw_terminal_parser_template.h, which an
+** implementation can include with its callbacks known at compile time
+** so they get called directly, or inlined, instead of going through
+** the callbacks table. See lw_terminal_vt100.c.
+**
 ** Exemple
 ** =======
 **
@@ -95,7 +145,10 @@
 **
 */
 
-#define TERM_STACK_SIZE 1024
+#include <stddef.h>
+
+#define TERM_STACK_SIZE 32
+#define TERM_PARAM_MAX  65535
 
 enum term_state
 {
@@ -104,7 +157,41 @@ enum term_state
     HASH,
     G0SET,
     G1SET,
-    CSI
+    CSI,
+    STRING,
+    STRING_ST /* ESC read in a string */
+};
+
+enum lw_terminal_string_kind
+{
+    STRING_OSC,
+    STRING_DCS,
+    STRING_APC,
+    STRING_PM,
+    STRING_SOS
+};
+
+#define LW_TERMINAL_STATS_SAMPLE  64
+#define LW_TERMINAL_STATS_BUCKETS 16
+#define LW_TERMINAL_STATS_FINALS  ('z' - '0' + 1)
+
+enum lw_terminal_stats_kind
+{
+    STATS_ESC,
+    STATS_CSI,
+    STATS_HASH,
+    STATS_SCS,
+    STATS_KINDS
+};
+
+struct lw_terminal_stats
+{
+    unsigned long dispatched[STATS_KINDS][LW_TERMINAL_STATS_FINALS];
+    unsigned int  histogram[STATS_KINDS][LW_TERMINAL_STATS_FINALS]
+                           [LW_TERMINAL_STATS_BUCKETS];
+    unsigned long writes;
+    unsigned long unimplemented;
+    unsigned long param_overflows;
 };
 
 struct lw_terminal;
@@ -210,18 +297,37 @@ struct lw_terminal
     unsigned int           argc;
     unsigned int           argv[TERM_STACK_SIZE];
     void                   (*write)(struct lw_terminal *, char c);
-    char                   stack[TERM_STACK_SIZE];
-    unsigned int           stack_ptr;
+    int                    got_something; /* Digits read for argv[argc] */
     struct term_callbacks  callbacks;
+    const struct term_callbacks *cb; /* &callbacks unless shared */
     char                   flag;
     void                   *user_data;
     void                   (*unimplemented)(struct lw_terminal*,
                                             char *seq, char chr);
+    void                   (*string)(struct lw_terminal *,
+                                     enum lw_terminal_string_kind kind,
+                                     const char *chunk, size_t len,
+                                     int final);
+    unsigned int           string_kinds;
+    enum lw_terminal_string_kind string_kind; /* Of the string being read */
+    /*
+    ** NULL unless built with LW_TERMINAL_STATS, but always there so
+    ** the size of the struct, given to lw_terminal_parser_init_at,
+    ** does not depend on the build.
+    */
+    struct lw_terminal_stats *stats;
 };
 
 struct lw_terminal *lw_terminal_parser_init(void);
+struct lw_terminal *lw_terminal_parser_init_at(void *memory);
+void lw_terminal_parser_reset(struct lw_terminal *this);
 void lw_terminal_parser_default_unimplemented(struct lw_terminal* this, char *seq, char chr);
 void lw_terminal_parser_read(struct lw_terminal *this, char c);
 void lw_terminal_parser_read_str(struct lw_terminal *this, char *c);
+void lw_terminal_parser_read_buf(struct lw_terminal *this,
+                                 const char *buffer, size_t len);
 void lw_terminal_parser_destroy(struct lw_terminal* this);
+void lw_terminal_parser_destroy_at(struct lw_terminal *this);
+int lw_terminal_parser_stats(struct lw_terminal *this,
+                             struct lw_terminal_stats *stats);
 #endif
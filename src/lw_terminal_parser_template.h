@@ -0,0 +1,337 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+** The parser's state machine, as a template. lw_terminal_parser.c
+** instantiates it for the callbacks API, a terminal can instantiate it
+** with its handlers known at compile time, so they get inlined in the
+** parsing loop instead of being called through the callbacks table,
+** see lw_terminal_vt100.c. Define before including it:
+**
+** LW_TERMINAL_PARSER_READ, LW_TERMINAL_PARSER_READ_BUF :
+**     The names of the static functions to generate, reading one char
+**     like lw_terminal_parser_read, and a buffer like
+**     lw_terminal_parser_read_buf:
+**     void LW_TERMINAL_PARSER_READ(struct lw_terminal *this, char c)
+**     void LW_TERMINAL_PARSER_READ_BUF(struct lw_terminal *this,
+**                                      const char *buffer, size_t len)
+**
+** LW_TERMINAL_PARSER_WRITE(this, c) :
+**     Gets the chars that are not part of sequences.
+**
+** LW_TERMINAL_PARSER_CALL(this, kind, c) :
+**     Runs the action for the final byte c of a sequence of the given
+**     kind (enum lw_terminal_stats_kind) through
+**     LW_TERMINAL_PARSER_DISPATCH(this, kind, c, action), so statistics
+**     are kept, giving 0 if there is no such action.
+**
+** A file can only instantiate it once.
+*/
+
+#include <string.h>
+#ifdef LW_TERMINAL_STATS
+#    include <time.h>
+#endif
+
+#include "lw_terminal_parser.h"
+
+#ifdef LW_TERMINAL_STATS
+#    define STATS_INCR(this, counter) ((this)->stats->counter += 1)
+#    define LW_TERMINAL_PARSER_DISPATCH(this, kind, c, action) \
+    lw_terminal_parser_dispatch(this, kind, c, action)
+
+static void lw_terminal_parser_dispatch(struct lw_terminal *this,
+                                        enum lw_terminal_stats_kind kind,
+                                        char c, term_action action)
+{
+    struct timespec start;
+    struct timespec end;
+    unsigned long ns;
+    unsigned int bucket;
+
+    if (++this->stats->dispatched[kind][c - '0'] % LW_TERMINAL_STATS_SAMPLE)
+    {
+        action(this);
+        return ;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    action(this);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ns = (end.tv_sec - start.tv_sec) * 1000000000UL
+        + end.tv_nsec - start.tv_nsec;
+    for (bucket = 0; ns > 1 && bucket < LW_TERMINAL_STATS_BUCKETS - 1; ++bucket)
+        ns >>= 1;
+    this->stats->histogram[kind][c - '0'][bucket] += 1;
+}
+#else
+#    define STATS_INCR(this, counter) ((void)0)
+#    define LW_TERMINAL_PARSER_DISPATCH(this, kind, c, action) (action)(this)
+#endif
+
+#define WRITE(this, c) (STATS_INCR(this, writes),       \
+                        LW_TERMINAL_PARSER_WRITE(this, c))
+
+/*
+** Parameters are parsed as they come, so every char costs the same
+** whatever the output: past TERM_STACK_SIZE parameters, the next ones
+** are dropped, and values saturate at TERM_PARAM_MAX.
+*/
+static void lw_terminal_parser_push(struct lw_terminal *this, char c)
+{
+    unsigned int digit;
+
+    if (this->argc >= TERM_STACK_SIZE)
+    {
+        STATS_INCR(this, param_overflows);
+        return ;
+    }
+    if (c == ';')
+    {
+        this->argc += 1;
+        this->got_something = 0;
+        if (this->argc < TERM_STACK_SIZE)
+            this->argv[this->argc] = 0;
+        return ;
+    }
+    digit = c - '0';
+    this->got_something = 1;
+    if (this->argv[this->argc] > (TERM_PARAM_MAX - digit) / 10)
+        this->argv[this->argc] = TERM_PARAM_MAX;
+    else
+        this->argv[this->argc] = this->argv[this->argc] * 10 + digit;
+}
+
+static void lw_terminal_parser_call_CSI(struct lw_terminal *this, char c)
+{
+    this->argc += this->got_something;
+    if (!LW_TERMINAL_PARSER_CALL(this, STATS_CSI, c))
+    {
+        STATS_INCR(this, unimplemented);
+        if (this->unimplemented != NULL)
+            this->unimplemented(this, "CSI", c);
+    }
+    this->state = INIT;
+    this->flag = '\0';
+    this->got_something = 0;
+    this->argc = 0;
+}
+
+static void lw_terminal_parser_call_ESC(struct lw_terminal *this, char c)
+{
+    if (!LW_TERMINAL_PARSER_CALL(this, STATS_ESC, c))
+    {
+        STATS_INCR(this, unimplemented);
+        if (this->unimplemented != NULL)
+            this->unimplemented(this, "ESC", c);
+    }
+    this->state = INIT;
+    this->got_something = 0;
+    this->argc = 0;
+}
+
+static void lw_terminal_parser_call_HASH(struct lw_terminal *this, char c)
+{
+    if (!LW_TERMINAL_PARSER_CALL(this, STATS_HASH, c))
+    {
+        STATS_INCR(this, unimplemented);
+        if (this->unimplemented != NULL)
+            this->unimplemented(this, "HASH", c);
+    }
+    this->state = INIT;
+    this->got_something = 0;
+    this->argc = 0;
+}
+
+static void lw_terminal_parser_call_GSET(struct lw_terminal *this, char c)
+{
+    if (c < '0' || c > 'B' || !LW_TERMINAL_PARSER_CALL(this, STATS_SCS, c))
+    {
+        STATS_INCR(this, unimplemented);
+        if (this->unimplemented != NULL)
+            this->unimplemented(this, "GSET", c);
+    }
+    this->state = INIT;
+    this->got_something = 0;
+    this->argc = 0;
+}
+
+/*
+** Hands a chunk of the string being read to the string callback, if
+** it wants strings of this kind.
+*/
+static void lw_terminal_parser_string(struct lw_terminal *this,
+                                      const char *chunk, size_t len,
+                                      int final)
+{
+    if (this->string != NULL
+        && (this->string_kinds & (1U << this->string_kind)))
+        this->string(this, this->string_kind, chunk, len, final);
+}
+
+static void lw_terminal_parser_begin_string(struct lw_terminal *this,
+                                            char c)
+{
+    if (c == ']')
+        this->string_kind = STRING_OSC;
+    else if (c == 'P')
+        this->string_kind = STRING_DCS;
+    else if (c == '_')
+        this->string_kind = STRING_APC;
+    else if (c == '^')
+        this->string_kind = STRING_PM;
+    else
+        this->string_kind = STRING_SOS;
+    this->state = STRING;
+}
+
+static void lw_terminal_parser_end_string(struct lw_terminal *this)
+{
+    this->state = INIT;
+    lw_terminal_parser_string(this, "", 0, 1);
+}
+
+/*
+** INIT
+**  \_ ESC "\033"
+**  |   \_ CSI   "\033["
+**  |   |   \_ c == '?' : term->flag = '?'
+**  |   |   \_ c == ';' || (c >= '0' && c <= '9') : term_push
+**  |   |   \_ else : term_call_CSI()
+**  |   \_ HASH  "\033#"
+**  |   |   \_ term_call_hash()
+**  |   \_ G0SET "\033("
+**  |   |   \_ term_call_GSET()
+**  |   \_ G1SET "\033)"
+**  |   |   \_ term_call_GSET()
+**  |   \_ STRING "\033]", "\033P", "\033_", "\033^" or "\033X"
+**  |       \_ c == BEL for OSC : term_end_string()
+**  |       \_ STRING_ST "\033"
+**  |       |   \_ c == '\\' : term_end_string()
+**  |       |   \_ else : term_end_string(), back to ESC
+**  |       \_ else : term->string()
+**  \_ term->write()
+*/
+static void LW_TERMINAL_PARSER_READ(struct lw_terminal *this, char c)
+{
+    if (this->state == STRING_ST)
+    {
+        lw_terminal_parser_end_string(this);
+        if (c == '\\')
+            return ;
+        this->state = ESC;
+    }
+    if (this->state == INIT)
+    {
+        if (c == '\033')
+            this->state = ESC;
+        else
+            WRITE(this, c);
+    }
+    else if (this->state == ESC)
+    {
+        if (c == '[')
+        {
+            this->state = CSI;
+            this->argc = 0;
+            this->argv[0] = 0;
+            this->got_something = 0;
+        }
+        else if (c == '#')
+            this->state = HASH;
+        else if (c == '(')
+            this->state = G0SET;
+        else if (c == ')')
+            this->state = G1SET;
+        else if (c == ']' || c == 'P' || c == '_' || c == '^' || c == 'X')
+            lw_terminal_parser_begin_string(this, c);
+        else if (c >= '0' && c <= 'z')
+            lw_terminal_parser_call_ESC(this, c);
+        else WRITE(this, c);
+    }
+    else if (this->state == HASH)
+    {
+        if (c >= '0' && c <= '9')
+            lw_terminal_parser_call_HASH(this, c);
+        else
+            WRITE(this, c);
+    }
+    else if (this->state == G0SET || this->state == G1SET)
+    {
+        lw_terminal_parser_call_GSET(this, c);
+    }
+    else if (this->state == CSI)
+    {
+        if (c == '?')
+            this->flag = '?';
+        else if (c == ';' || (c >= '0' && c <= '9'))
+            lw_terminal_parser_push(this, c);
+        else if (c >= '?' && c <= 'z')
+            lw_terminal_parser_call_CSI(this, c);
+        else
+            WRITE(this, c);
+    }
+    else if (this->state == STRING)
+    {
+        if (c == '\033')
+            this->state = STRING_ST;
+        else if (c == '\007' && this->string_kind == STRING_OSC)
+            lw_terminal_parser_end_string(this);
+        else
+            lw_terminal_parser_string(this, &c, 1, 0);
+    }
+}
+
+/*
+** Strings are read up to what may end them in one go, handed over
+** without being copied.
+*/
+static void LW_TERMINAL_PARSER_READ_BUF(struct lw_terminal *this,
+                                        const char *buffer, size_t len)
+{
+    const char *end;
+    const char *stop;
+    const char *bel;
+
+    end = buffer + len;
+    while (buffer < end)
+    {
+        if (this->state != STRING)
+        {
+            LW_TERMINAL_PARSER_READ(this, *buffer++);
+            continue ;
+        }
+        stop = memchr(buffer, '\033', end - buffer);
+        if (stop == NULL)
+            stop = end;
+        if (this->string_kind == STRING_OSC
+            && (bel = memchr(buffer, '\007', stop - buffer)) != NULL)
+            stop = bel;
+        if (stop > buffer)
+            lw_terminal_parser_string(this, buffer, stop - buffer, 0);
+        if (stop < end)
+            LW_TERMINAL_PARSER_READ(this, *stop++);
+        buffer = stop;
+    }
+}
@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include "lw_terminal_vt100.h"
+#include "vt100_shm.h"
 
 static unsigned int get_mode_mask(unsigned int mode)
 {
@@ -176,55 +177,322 @@ static unsigned int get_mode_mask(unsigned int mode)
   no increase in character resolution.
 */
 
-#define SCREEN_PTR(vt100, x, y)                                 \
-    ((vt100->top_line * vt100->width + x + vt100->width * y)    \
-     % (vt100->width * SCROLLBACK * vt100->height))
+/*
+** A row of cells. Rows come from the emulator's arena, or from malloc
+** when copied on write: a clone shares its parent's rows, counting
+** references, until either side writes to one of them.
+*/
+struct lw_terminal_vt100_row
+{
+    unsigned int refs;
+    struct lw_terminal_vt100_arena *arena; /* NULL if malloc'd */
+    char cells[132];
+};
+
+#define RING_SLOT(vt100, y)                                             \
+    (&(vt100)->ring[((vt100)->top_line + (y)) % (SCROLLBACK * (vt100)->height)])
 
-#define FROZEN_SCREEN_PTR(vt100, x, y)              \
-    ((x + vt100->width * y)                         \
-     % (vt100->width * SCROLLBACK * vt100->height))
+static void arena_release(struct lw_terminal_vt100_arena *arena);
+
+static void row_release(struct lw_terminal_vt100_row *row)
+{
+    if (__atomic_sub_fetch(&row->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return ;
+    if (row->arena == NULL)
+        free(row);
+    else
+        arena_release(row->arena);
+}
+
+static struct lw_terminal_vt100_row **row_slot(struct lw_terminal_vt100 *vt100,
+                                               unsigned int y)
+{
+    if (y < vt100->margin_top || y > vt100->margin_bottom)
+        return &vt100->frozen[y];
+    return RING_SLOT(vt100, y);
+}
+
+/*
+** Returns the cells of the row in slot for writing, copying the row
+** first if it is shared. NULL if memory is short.
+*/
+static char *writable(struct lw_terminal_vt100_row **slot)
+{
+    struct lw_terminal_vt100_row *row;
+
+    if (__atomic_load_n(&(*slot)->refs, __ATOMIC_ACQUIRE) == 1)
+        return (*slot)->cells;
+    row = malloc(sizeof(*row));
+    if (row == NULL)
+        return NULL;
+    row->refs = 1;
+    row->arena = NULL;
+    memcpy(row->cells, (*slot)->cells, 132);
+    row_release(*slot);
+    *slot = row;
+    return row->cells;
+}
+
+/*
+** Marks line y as changed and returns its cells for writing, NULL
+** while skimming, for a line off the screen or if memory is short.
+*/
+static char *dirty_line(struct lw_terminal_vt100 *headless_term,
+                        unsigned int y)
+{
+    if (headless_term->skimming || y >= headless_term->height)
+        return NULL;
+    headless_term->line_generation[y] = headless_term->generation;
+    if (headless_term->watched[y])
+    {
+        headless_term->watch_dirty[y] = 1;
+        headless_term->watch_pending = 1;
+    }
+    return writable(row_slot(headless_term, y));
+}
 
 static void set(struct lw_terminal_vt100 *headless_term,
                 unsigned int x, unsigned int y,
                 char c)
 {
-    if (y < headless_term->margin_top || y > headless_term->margin_bottom)
-        headless_term->frozen_screen[FROZEN_SCREEN_PTR(headless_term, x, y)] = c;
-    else
-        headless_term->screen[SCREEN_PTR(headless_term, x, y)] = c;
+    char *cells;
+
+    /* Rows being apart, a cursor off the screen writes nowhere */
+    if (x >= headless_term->width)
+        return ;
+    cells = dirty_line(headless_term, y);
+    if (cells != NULL)
+        cells[x] = c;
+}
+
+/*
+** Sets columns [from, to) of line y to c, as one write to the row
+** rather than one set() per cell.
+*/
+static void fill(struct lw_terminal_vt100 *headless_term,
+                 unsigned int y, unsigned int from, unsigned int to,
+                 char c)
+{
+    char *cells;
+
+    if (to > headless_term->width)
+        to = headless_term->width;
+    if (from >= to)
+        return ;
+    cells = dirty_line(headless_term, y);
+    if (cells != NULL)
+        memset(cells + from, c, to - from);
+}
+
+
+static int wake(struct lw_terminal_vt100 *this);
+static void fire_watches(struct lw_terminal_vt100 *this);
+
+/* What readers get from an emulator too short of memory to wake up */
+static const char blank_row[132] =
+    "                                                                  "
+    "                                                                  ";
+
+/*
+** An emulator's parser, rows and tab stops live in one arena, sized
+** for a number of rows rounded up to a multiple of ARENA_ROWS. Up to
+** POOL_KEEP released arenas are kept per size, so creating, resizing
+** and destroying emulators seldom reaches the allocator. Clones get
+** an arena without rows. As rows may outlive their emulator in a
+** clone, an arena goes back to the pool once nothing uses it.
+*/
+#define ARENA_ROWS 8
+#define ARENA_CLASSES (80 / ARENA_ROWS + 1)
+#define POOL_KEEP 8
+
+struct lw_terminal_vt100_arena
+{
+    struct lw_terminal_vt100_arena *next; /* While pooled */
+    unsigned int rows;
+    unsigned int live; /* Rows in use, plus one for its emulator */
+    int unpooled; /* Freed instead of pooled once released */
+};
+
+#define ARENA_PARSER(arena) ((struct lw_terminal *)((arena) + 1))
+#define ARENA_ROW(arena, i)                                             \
+    ((struct lw_terminal_vt100_row *)(ARENA_PARSER(arena) + 1) + (i))
+#define ARENA_TABULATIONS(arena)                                        \
+    ((char *)ARENA_ROW(arena, (SCROLLBACK + 1) * (arena)->rows))
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct lw_terminal_vt100_arena *pool[ARENA_CLASSES];
+static unsigned int pooled[ARENA_CLASSES];
+
+static size_t arena_size(unsigned int rows)
+{
+    return sizeof(struct lw_terminal_vt100_arena) + sizeof(struct lw_terminal)
+        + sizeof(struct lw_terminal_vt100_row) * (SCROLLBACK + 1) * rows
+        + 132;
 }
 
+/*
+** Returns an arena for at least height rows, its content undefined,
+** used by its emulator only.
+*/
+static struct lw_terminal_vt100_arena *arena_get(unsigned int height)
+{
+    struct lw_terminal_vt100_arena *arena;
+    unsigned int class;
+
+    class = (height + ARENA_ROWS - 1) / ARENA_ROWS;
+    pthread_mutex_lock(&pool_mutex);
+    arena = pool[class];
+    if (arena != NULL)
+    {
+        pool[class] = arena->next;
+        pooled[class] -= 1;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    if (arena == NULL)
+    {
+        arena = malloc(arena_size(class * ARENA_ROWS));
+        if (arena == NULL)
+            return NULL;
+        arena->rows = class * ARENA_ROWS;
+    }
+    arena->live = 1;
+    arena->unpooled = 0;
+    return arena;
+}
+
+static void arena_put(struct lw_terminal_vt100_arena *arena)
+{
+    unsigned int class;
+
+    class = arena->rows / ARENA_ROWS;
+    pthread_mutex_lock(&pool_mutex);
+    if (pooled[class] < POOL_KEEP && !arena->unpooled)
+    {
+        arena->next = pool[class];
+        pool[class] = arena;
+        pooled[class] += 1;
+        arena = NULL;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    free(arena);
+}
+
+/*
+** Drops one use of an arena, by its emulator or by a row.
+*/
+static void arena_release(struct lw_terminal_vt100_arena *arena)
+{
+    if (__atomic_sub_fetch(&arena->live, 1, __ATOMIC_ACQ_REL) == 0)
+        arena_put(arena);
+}
+
+/*
+** Points the emulator at an arena, or at nothing, returning the
+** previous one. The parser pointer and the rows are left to the
+** caller.
+*/
+static struct lw_terminal_vt100_arena *arena_use(
+    struct lw_terminal_vt100 *this, struct lw_terminal_vt100_arena *arena)
+{
+    struct lw_terminal_vt100_arena *previous;
+
+    previous = this->arena;
+    this->arena = arena;
+    this->tabulations = arena == NULL ? NULL : ARENA_TABULATIONS(arena);
+    return previous;
+}
+
+/*
+** Fills the ring and the frozen rows, for the current height, from the
+** arena's own rows, whose content is left alone.
+*/
+static void rows_attach(struct lw_terminal_vt100 *this,
+                        struct lw_terminal_vt100_arena *arena)
+{
+    struct lw_terminal_vt100_row *row;
+    unsigned int i;
+
+    for (i = 0; i < (SCROLLBACK + 1) * this->height; ++i)
+    {
+        row = ARENA_ROW(arena, i);
+        row->refs = 1;
+        row->arena = arena;
+        if (i < SCROLLBACK * this->height)
+            this->ring[i] = row;
+        else
+            this->frozen[i - SCROLLBACK * this->height] = row;
+    }
+    __atomic_add_fetch(&arena->live, (SCROLLBACK + 1) * this->height,
+                       __ATOMIC_RELAXED);
+}
+
+static void rows_release(struct lw_terminal_vt100 *this)
+{
+    unsigned int i;
+
+    for (i = 0; i < SCROLLBACK * this->height; ++i)
+        row_release(this->ring[i]);
+    for (i = 0; i < this->height; ++i)
+        row_release(this->frozen[i]);
+}
 
 char lw_terminal_vt100_get(struct lw_terminal_vt100 *vt100, unsigned int x, unsigned int y)
 {
-    if (y < vt100->margin_top || y > vt100->margin_bottom)
-        return vt100->frozen_screen[FROZEN_SCREEN_PTR(vt100, x, y)];
+    char c;
+
+    pthread_mutex_lock(&vt100->mutex);
+    if (x >= 132 || y >= vt100->height || wake(vt100) == -1)
+        c = ' ';
     else
-        return vt100->screen[SCREEN_PTR(vt100, x, y)];
+        c = (*row_slot(vt100, y))->cells[x];
+    pthread_mutex_unlock(&vt100->mutex);
+    return c;
+}
+
+/*
+** Scrolling moves the whole ring below the frozen margins, so every
+** line of the scrolling region has to be considered as changed.
+*/
+static void touch_lines(struct lw_terminal_vt100 *vt100,
+                        unsigned int from, unsigned int to)
+{
+    unsigned int y;
+
+    for (y = from; y <= to && y < vt100->height; ++y)
+    {
+        vt100->line_generation[y] = vt100->generation;
+        if (vt100->watched[y])
+        {
+            vt100->watch_dirty[y] = 1;
+            vt100->watch_pending = 1;
+        }
+    }
 }
 
 static void froze_line(struct lw_terminal_vt100 *vt100, unsigned int y)
 {
-    memcpy(vt100->frozen_screen + vt100->width * y,
-           vt100->screen + SCREEN_PTR(vt100, 0, y),
-           vt100->width);
+    char *cells;
+
+    cells = writable(&vt100->frozen[y]);
+    if (cells != NULL)
+        memcpy(cells, (*RING_SLOT(vt100, y))->cells, vt100->width);
 }
 
 static void unfroze_line(struct lw_terminal_vt100 *vt100, unsigned int y)
 {
-    memcpy(vt100->screen + SCREEN_PTR(vt100, 0, y),
-           vt100->frozen_screen + vt100->width * y,
-           vt100->width);
+    char *cells;
+
+    cells = writable(RING_SLOT(vt100, y));
+    if (cells != NULL)
+        memcpy(cells, vt100->frozen[y]->cells, vt100->width);
 }
 
 static void blank_screen(struct lw_terminal_vt100 *lw_terminal_vt100)
 {
-    unsigned int x;
     unsigned int y;
 
-    for (x = 0; x < lw_terminal_vt100->width; ++x)
-        for (y = 0; y < lw_terminal_vt100->height; ++y)
-            set(lw_terminal_vt100, x, y, ' ');
+    for (y = 0; y < lw_terminal_vt100->height; ++y)
+        fill(lw_terminal_vt100, y, 0, lw_terminal_vt100->width, ' ');
 }
 
 /*
@@ -269,6 +537,7 @@ static void RM(struct lw_terminal *term_emul)
         {
             vt100->width = 80;
             vt100->x = vt100->y = 0;
+            vt100->saved_x = vt100->saved_y = 0;
             blank_screen(vt100);
         }
         UNSET_MODE(vt100, mode);
@@ -317,6 +586,10 @@ static void CUP(struct lw_terminal *term_emul)
         if ((unsigned int)arg0 > vt100->margin_bottom)
             arg0 = vt100->margin_bottom;
     }
+    if ((unsigned int)arg0 >= vt100->height)
+        arg0 = vt100->height - 1;
+    if ((unsigned int)arg1 >= vt100->width)
+        arg1 = vt100->width - 1;
     vt100->y = arg0;
     vt100->x = arg1;
 }
@@ -352,6 +625,7 @@ static void SM(struct lw_terminal *term_emul)
         {
             vt100->width = 132;
             vt100->x = vt100->y = 0;
+            vt100->saved_x = vt100->saved_y = 0;
             blank_screen(vt100);
         }
         if (mode == DECOM)
@@ -389,11 +663,13 @@ static void DECSTBM(struct lw_terminal *term_emul)
 
     if (term_emul->argc == 2)
     {
-        margin_top = term_emul->argv[0] - 1;
-        margin_bottom = term_emul->argv[1] - 1;
+        /* Zero means the default, and a region needs two lines */
+        margin_top = term_emul->argv[0] > 0 ? term_emul->argv[0] - 1 : 0;
+        margin_bottom = term_emul->argv[1] > 0 ? term_emul->argv[1] - 1
+            : vt100->height - 1;
         if (margin_bottom >= vt100->height)
             return ;
-        if (margin_bottom - margin_top <= 0)
+        if (margin_bottom <= margin_top)
             return ;
     }
     else
@@ -403,11 +679,11 @@ static void DECSTBM(struct lw_terminal *term_emul)
     }
     for (line = vt100->margin_top; line < margin_top; ++line)
         froze_line(vt100, line);
-    for (line = vt100->margin_bottom; line < margin_bottom; ++line)
+    for (line = vt100->margin_bottom + 1; line <= margin_bottom; ++line)
         unfroze_line(vt100, line);
     for (line = margin_top; line < vt100->margin_top; ++line)
         unfroze_line(vt100, line);
-    for (line = margin_bottom; line < vt100->margin_bottom; ++line)
+    for (line = margin_bottom + 1; line <= vt100->margin_bottom; ++line)
         froze_line(vt100, line);
     vt100->margin_bottom = margin_bottom;
     vt100->margin_top = margin_top;
@@ -490,8 +766,11 @@ static void DECRC(struct lw_terminal *term_emul)
     struct lw_terminal_vt100 *vt100;
 
     vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
-    vt100->x = vt100->saved_x;
-    vt100->y = vt100->saved_y;
+    /* The screen may have shrunk since, by DECCOLM or a resize */
+    vt100->x = vt100->saved_x < vt100->width ? vt100->saved_x
+        : vt100->width - 1;
+    vt100->y = vt100->saved_y < vt100->height ? vt100->saved_y
+        : vt100->height - 1;
 }
 
 /*
@@ -506,13 +785,24 @@ static void DECRC(struct lw_terminal *term_emul)
 static void DECALN(struct lw_terminal *term_emul)
 {
     struct lw_terminal_vt100 *vt100;
-    unsigned int x;
     unsigned int y;
 
     vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
-    for (x = 0; x < vt100->width; ++x)
-        for (y = 0; y < vt100->height; ++y)
-            set(vt100, x, y, 'E');
+    for (y = 0; y < vt100->height; ++y)
+        fill(vt100, y, 0, vt100->width, 'E');
+}
+
+/*
+** Hands the top line of the screen to scrolled_out before it goes,
+** unless the top margin keeps it on screen. Lines skimmed by lazy
+** parsing never get there, so lazy parsing is off while scrolled_out
+** is set.
+*/
+static void scroll_out(struct lw_terminal_vt100 *vt100)
+{
+    if (vt100->scrolled_out != NULL && vt100->margin_top == 0)
+        vt100->scrolled_out(vt100->user_data,
+                            (*RING_SLOT(vt100, 0))->cells, vt100->width);
 }
 
 /*
@@ -527,15 +817,15 @@ static void DECALN(struct lw_terminal *term_emul)
 static void IND(struct lw_terminal *term_emul)
 {
     struct lw_terminal_vt100 *vt100;
-    unsigned int x;
 
     vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
     if (vt100->y >= vt100->margin_bottom)
     {
         /* SCROLL */
+        scroll_out(vt100);
         vt100->top_line = (vt100->top_line + 1) % (vt100->height * SCROLLBACK);
-        for (x = 0; x < vt100->width; ++x)
-            set(vt100, x, vt100->margin_bottom, ' ');
+        touch_lines(vt100, vt100->margin_top, vt100->margin_bottom);
+        fill(vt100, vt100->margin_bottom, 0, vt100->width, ' ');
 
     }
     else
@@ -558,12 +848,15 @@ static void RI(struct lw_terminal *term_emul)
     struct lw_terminal_vt100 *vt100;
 
     vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
-    if (vt100->y == 0)
+    if (vt100->y == vt100->margin_top)
     {
         /* SCROLL */
-        vt100->top_line = (vt100->top_line - 1) % (vt100->height * SCROLLBACK);
+        vt100->top_line = (vt100->top_line + vt100->height * SCROLLBACK - 1)
+            % (vt100->height * SCROLLBACK);
+        touch_lines(vt100, vt100->margin_top, vt100->margin_bottom);
+        fill(vt100, vt100->margin_top, 0, vt100->width, ' ');
     }
-    else
+    else if (vt100->y > 0)
     {
         /* Do not scroll, just move upward on the current display space */
         vt100->y -= 1;
@@ -582,15 +875,15 @@ static void RI(struct lw_terminal *term_emul)
 static void NEL(struct lw_terminal *term_emul)
 {
     struct lw_terminal_vt100 *vt100;
-    unsigned int x;
 
     vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
     if (vt100->y >= vt100->margin_bottom)
     {
         /* SCROLL */
+        scroll_out(vt100);
         vt100->top_line = (vt100->top_line + 1) % (vt100->height * SCROLLBACK);
-        for (x = 0; x < vt100->width; ++x)
-            set(vt100, x, vt100->margin_bottom, ' ');
+        touch_lines(vt100, vt100->margin_top, vt100->margin_bottom);
+        fill(vt100, vt100->margin_bottom, 0, vt100->width, ' ');
     }
     else
     {
@@ -735,7 +1028,6 @@ static void ED(struct lw_terminal *term_emul)
 {
     struct lw_terminal_vt100 *vt100;
     unsigned int arg0;
-    unsigned int x;
     unsigned int y;
 
     vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
@@ -744,25 +1036,20 @@ static void ED(struct lw_terminal *term_emul)
         arg0 = term_emul->argv[0];
     if (arg0 == 0)
     {
-        for (x = vt100->x; x < vt100->width; ++x)
-            set(vt100, x, vt100->y, ' ');
-        for (x = 0 ; x < vt100->width; ++x)
-            for (y = vt100->y + 1; y < vt100->height; ++y)
-                set(vt100, x, y, ' ');
+        fill(vt100, vt100->y, vt100->x, vt100->width, ' ');
+        for (y = vt100->y + 1; y < vt100->height; ++y)
+            fill(vt100, y, 0, vt100->width, ' ');
     }
     else if (arg0 == 1)
     {
-        for (x = 0 ; x < vt100->width; ++x)
-            for (y = 0; y < vt100->y; ++y)
-                set(vt100, x, y, ' ');
-        for (x = 0; x <= vt100->x; ++x)
-            set(vt100, x, vt100->y, ' ');
+        for (y = 0; y < vt100->y && y < vt100->height; ++y)
+            fill(vt100, y, 0, vt100->width, ' ');
+        fill(vt100, vt100->y, 0, vt100->x + 1, ' ');
     }
     else if (arg0 == 2)
     {
-        for (x = 0 ; x < vt100->width; ++x)
-            for (y = 0; y < vt100->height; ++y)
-                set(vt100, x, y, ' ');
+        for (y = 0; y < vt100->height; ++y)
+            fill(vt100, y, 0, vt100->width, ' ');
     }
 }
 
@@ -784,27 +1071,17 @@ static void EL(struct lw_terminal *term_emul)
 {
     struct lw_terminal_vt100 *vt100;
     unsigned int arg0;
-    unsigned int x;
 
     vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
     arg0 = 0;
     if (term_emul->argc > 0)
         arg0 = term_emul->argv[0];
     if (arg0 == 0)
-    {
-        for (x = vt100->x; x < vt100->width; ++x)
-            set(vt100, x, vt100->y, ' ');
-    }
+        fill(vt100, vt100->y, vt100->x, vt100->width, ' ');
     else if (arg0 == 1)
-    {
-        for (x = 0; x <= vt100->x; ++x)
-            set(vt100, x, vt100->y, ' ');
-    }
+        fill(vt100, vt100->y, 0, vt100->x + 1, ' ');
     else if (arg0 == 2)
-    {
-        for (x = 0; x < vt100->width; ++x)
-            set(vt100, x, vt100->y, ' ');
-    }
+        fill(vt100, vt100->y, 0, vt100->width, ' ');
 }
 
 /*
@@ -836,7 +1113,8 @@ static void TBC(struct lw_terminal *term_emul)
     vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
     if (term_emul->argc == 0 || term_emul->argv[0] == 0)
     {
-        vt100->tabulations[vt100->x] = '-';
+        if (vt100->x < vt100->width)
+            vt100->tabulations[vt100->x] = '-';
     }
     else if (term_emul->argc == 1 && term_emul->argv[0] == 3)
     {
@@ -850,7 +1128,23 @@ static void HTS(struct lw_terminal *term_emul)
     struct lw_terminal_vt100 *vt100;
 
     vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
-    vt100->tabulations[vt100->x] = '|';
+    if (vt100->x < vt100->width)
+        vt100->tabulations[vt100->x] = '|';
+}
+
+static void reset_state(struct lw_terminal_vt100 *this);
+
+/*
+  RIS – Reset To Initial State
+
+  ESC c
+
+  Reset the VT100 to its initial state, i.e., the state it has after it
+  is powered on.
+*/
+static void RIS(struct lw_terminal *term_emul)
+{
+    reset_state((struct lw_terminal_vt100 *)term_emul->user_data);
 }
 
 static void vt100_write(struct lw_terminal *term_emul, char c)
@@ -880,11 +1174,14 @@ static void vt100_write(struct lw_terminal *term_emul, char c)
     }
     if (c == '\t')
     {
-        do
-        {
-            set(vt100, vt100->x, vt100->y, ' ');
-            vt100->x += 1;
-        } while (vt100->x < vt100->width && vt100->tabulations[vt100->x] == '-');
+        /* Past the last column, a tab has nowhere left to go */
+        if (vt100->x < vt100->width)
+            do
+            {
+                set(vt100, vt100->x, vt100->y, ' ');
+                vt100->x += 1;
+            } while (vt100->x < vt100->width
+                     && vt100->tabulations[vt100->x] == '-');
         return ;
     }
     if (c == '\016')
@@ -908,101 +1205,1133 @@ static void vt100_write(struct lw_terminal *term_emul, char c)
     vt100->x += 1;
 }
 
+static const char *lw_terminal_vt100_line(struct lw_terminal_vt100 *vt100,
+                                          unsigned int y)
+{
+    return (*row_slot(vt100, y))->cells;
+}
+
 const char **lw_terminal_vt100_getlines(struct lw_terminal_vt100 *vt100)
 {
     unsigned int y;
 
     pthread_mutex_lock(&vt100->mutex);
-    for (y = 0; y < vt100->height; ++y)
-    if (y < vt100->margin_top || y > vt100->margin_bottom)
-        vt100->lines[y] = vt100->frozen_screen + FROZEN_SCREEN_PTR(vt100, 0, y);
+    if (wake(vt100) == -1)
+        for (y = 0; y < vt100->height; ++y)
+            vt100->lines[y] = (char *)blank_row;
     else
-        vt100->lines[y] = vt100->screen + SCREEN_PTR(vt100, 0, y);
+        for (y = 0; y < vt100->height; ++y)
+            vt100->lines[y] = (char *)lw_terminal_vt100_line(vt100, y);
     pthread_mutex_unlock(&vt100->mutex);
     return (const char **)vt100->lines;
 }
 
+/*
+** Copies the displayed rows one after the other in buffer, which must
+** hold at least 132 * height bytes, all under the same lock so the
+** copy is consistent. Returns the width of the copied rows.
+*/
+unsigned int lw_terminal_vt100_copy_screen(struct lw_terminal_vt100 *vt100,
+                                           char *buffer)
+{
+    unsigned int width;
+    unsigned int y;
+    int awake;
+
+    pthread_mutex_lock(&vt100->mutex);
+    awake = wake(vt100) == 0;
+    width = vt100->width;
+    if (!awake)
+        memset(buffer, ' ', width * vt100->height);
+    else
+        for (y = 0; y < vt100->height; ++y)
+            memcpy(buffer + y * width, lw_terminal_vt100_line(vt100, y),
+                   width);
+    pthread_mutex_unlock(&vt100->mutex);
+    return width;
+}
+
+/*
+** Copies the rows changed since the last publication, and the cursor
+** and modes, to the shared memory segment under its seqlock. Never
+** waits for the readers. Rows beyond those the segment was sized for
+** are left out. Called with the mutex held.
+*/
+static void publish(struct lw_terminal_vt100 *this)
+{
+    struct vt100_shm_screen *screen;
+    unsigned int sequence;
+    unsigned int height;
+    unsigned int y;
+    int all;
+
+    screen = this->shm->screen;
+    all = this->shm->fresh || screen->width != this->width;
+    sequence = screen->sequence;
+    __atomic_store_n(&screen->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    height = (this->shm->size - VT100_SHM_HEADER) / VT100_SHM_STRIDE;
+    if (height > this->height)
+        height = this->height;
+    for (y = 0; y < height; ++y)
+        if (all || (int)(this->line_generation[y] - this->shm->published) > 0)
+            memcpy((char *)VT100_SHM_ROW(screen, y),
+                   lw_terminal_vt100_line(this, y), this->width);
+    screen->generation = this->generation;
+    screen->width = this->width;
+    screen->height = height;
+    screen->x = this->x;
+    screen->y = this->y;
+    screen->modes = this->modes;
+    screen->margin_top = this->margin_top;
+    screen->margin_bottom = this->margin_bottom;
+    __atomic_store_n(&screen->sequence, sequence + 2, __ATOMIC_RELEASE);
+    this->shm->published = this->generation;
+    this->shm->fresh = 0;
+}
+
+void lw_terminal_vt100_publish(struct lw_terminal_vt100 *vt100)
+{
+    pthread_mutex_lock(&vt100->mutex);
+    if (vt100->shm != NULL && wake(vt100) == 0)
+        publish(vt100);
+    pthread_mutex_unlock(&vt100->mutex);
+}
+
+int lw_terminal_vt100_stats(struct lw_terminal_vt100 *vt100,
+                            struct lw_terminal_stats *stats)
+{
+    int ret;
+
+    pthread_mutex_lock(&vt100->mutex);
+    ret = wake(vt100) == -1 ? -1
+        : lw_terminal_parser_stats(vt100->lw_terminal, stats);
+    pthread_mutex_unlock(&vt100->mutex);
+    return ret;
+}
+
+/*
+** Power-up state: blank screen, no margins, tab stops every 8 columns.
+** Only touches memory already allocated, so instances can be reused.
+** Only the rows on display are blanked: scrolling blanks every row it
+** brings in, so the rest of the ring is never seen.
+*/
+static void reset_state(struct lw_terminal_vt100 *this)
+{
+    unsigned int i;
+    char *cells;
+
+    this->width = this->reset_width;
+    this->top_line = 0;
+    for (i = 0; i < this->height; ++i)
+    {
+        cells = writable(&this->ring[i]);
+        if (cells != NULL)
+            memset(cells, ' ', 132);
+        cells = writable(&this->frozen[i]);
+        if (cells != NULL)
+            memset(cells, ' ', 132);
+    }
+    for (i = 0; i < 132; ++i)
+        this->tabulations[i] = (i % 8 == 0 && i > 0) ? '|' : '-';
+    this->margin_top = 0;
+    this->margin_bottom = this->height - 1;
+    this->selected_charset = 0;
+    this->x = 0;
+    this->y = 0;
+    this->saved_x = 0;
+    this->saved_y = 0;
+    this->modes = MASK_DECANM;
+    touch_lines(this, 0, this->height - 1);
+    lw_terminal_parser_reset(this->lw_terminal);
+}
+
+void lw_terminal_vt100_reset(struct lw_terminal_vt100 *this)
+{
+    pthread_mutex_lock(&this->mutex);
+    this->pending_len = 0;
+    if (wake(this) == -1)
+    {
+        pthread_mutex_unlock(&this->mutex);
+        return ;
+    }
+    this->generation += 1;
+    reset_state(this);
+    if (this->shm != NULL)
+        publish(this);
+    pthread_mutex_unlock(&this->mutex);
+    fire_watches(this);
+}
+
+/*
+** Gives the screen a new size, up to 132 columns and 80 rows, keeping
+** the top left of what is displayed. Margins are reset.
+** Returns 0, or -1 if the size is out of bounds or memory is short.
+*/
+int lw_terminal_vt100_resize(struct lw_terminal_vt100 *this,
+                             unsigned int width, unsigned int height)
+{
+    struct lw_terminal_vt100_arena *arena;
+    unsigned int columns;
+    unsigned int y;
+
+    if (width == 0 || width > 132 || height == 0 || height > 80)
+        return -1;
+    arena = arena_get(height);
+    if (arena == NULL)
+        return -1;
+    for (y = 0; y < (SCROLLBACK + 1) * height; ++y)
+        memset(ARENA_ROW(arena, y)->cells, ' ', 132);
+    pthread_mutex_lock(&this->mutex);
+    if (wake(this) == -1)
+    {
+        pthread_mutex_unlock(&this->mutex);
+        arena_put(arena);
+        return -1;
+    }
+    columns = width < this->width ? width : this->width;
+    for (y = 0; y < height && y < this->height; ++y)
+        memcpy(ARENA_ROW(arena, y)->cells, lw_terminal_vt100_line(this, y),
+               columns);
+    memcpy(ARENA_TABULATIONS(arena), this->tabulations, 132);
+    /* The parser moves along, possibly in the middle of a sequence */
+    memcpy(ARENA_PARSER(arena), this->lw_terminal, sizeof(struct lw_terminal));
+    rows_release(this);
+    arena = arena_use(this, arena);
+    this->lw_terminal = ARENA_PARSER(this->arena);
+    this->width = this->reset_width = width;
+    this->height = height;
+    rows_attach(this, this->arena);
+    this->top_line = 0;
+    this->margin_top = 0;
+    this->margin_bottom = height - 1;
+    if (this->x >= width)
+        this->x = width - 1;
+    if (this->y >= height)
+        this->y = height - 1;
+    if (this->saved_x >= width)
+        this->saved_x = width - 1;
+    if (this->saved_y >= height)
+        this->saved_y = height - 1;
+    this->generation += 1;
+    touch_lines(this, 0, height - 1);
+    if (this->shm != NULL)
+    {
+        this->shm->fresh = 1;
+        publish(this);
+    }
+    pthread_mutex_unlock(&this->mutex);
+    arena_release(arena);
+    fire_watches(this);
+    return 0;
+}
+
+/*
+** The sequences implemented: kind, final byte, callbacks field, action.
+** They fill the callbacks table and the switch the parser is
+** specialized with, see parse.
+*/
+#define VT100_SEQUENCES(X)                      \
+    X(STATS_CSI, 'f', csi.f, HVP)               \
+    X(STATS_CSI, 'K', csi.K, EL)                \
+    X(STATS_CSI, 'c', csi.c, DA)                \
+    X(STATS_CSI, 'h', csi.h, SM)                \
+    X(STATS_CSI, 'l', csi.l, RM)                \
+    X(STATS_CSI, 'J', csi.J, ED)                \
+    X(STATS_CSI, 'H', csi.H, CUP)               \
+    X(STATS_CSI, 'C', csi.C, CUF)               \
+    X(STATS_CSI, 'B', csi.B, CUD)               \
+    X(STATS_CSI, 'r', csi.r, DECSTBM)           \
+    X(STATS_CSI, 'm', csi.m, SGR)               \
+    X(STATS_CSI, 'A', csi.A, CUU)               \
+    X(STATS_CSI, 'g', csi.g, TBC)               \
+    X(STATS_ESC, 'H', esc.H, HTS)               \
+    X(STATS_CSI, 'D', csi.D, CUB)               \
+    X(STATS_ESC, 'E', esc.E, NEL)               \
+    X(STATS_ESC, 'D', esc.D, IND)               \
+    X(STATS_ESC, 'M', esc.M, RI)                \
+    X(STATS_ESC, 'c', esc.c, RIS)               \
+    X(STATS_ESC, '8', esc.n8, DECRC)            \
+    X(STATS_ESC, '7', esc.n7, DECSC)            \
+    X(STATS_HASH, '8', hash.n8, DECALN)
+
+static pthread_once_t callbacks_once = PTHREAD_ONCE_INIT;
+static struct term_callbacks callbacks;
+
+#define FILL(kind, c, field, action) callbacks.field = action;
+
+static void fill_callbacks(void)
+{
+    VT100_SEQUENCES(FILL)
+}
+
+#define CALL(kind, c, field, action)                            \
+    case kind * 256 + c:                                        \
+        LW_TERMINAL_PARSER_DISPATCH(term_emul, kind, c, action); \
+        return 1;
+
+static int vt100_call(struct lw_terminal *term_emul,
+                      enum lw_terminal_stats_kind kind, char c);
+
+#define LW_TERMINAL_PARSER_READ vt100_read
+#define LW_TERMINAL_PARSER_READ_BUF vt100_read_buf
+#define LW_TERMINAL_PARSER_WRITE(this, c) vt100_write(this, c)
+#define LW_TERMINAL_PARSER_CALL(this, kind, c) vt100_call(this, kind, c)
+#include "lw_terminal_parser_template.h"
+
+static int vt100_call(struct lw_terminal *term_emul,
+                      enum lw_terminal_stats_kind kind, char c)
+{
+    switch (kind * 256 + (unsigned char)c)
+    {
+        VT100_SEQUENCES(CALL)
+    }
+    return 0;
+}
+
+/*
+** Parses output with the parser specialized for this emulator, its
+** actions called directly, unless it is told to go through the
+** callbacks table, or its callbacks were changed.
+*/
+static void parse(struct lw_terminal_vt100 *this,
+                  const char *data, size_t len)
+{
+    struct lw_terminal *parser;
+
+    parser = this->lw_terminal;
+    if (this->dynamic_dispatch || parser->cb != &callbacks
+        || parser->write != vt100_write)
+        lw_terminal_parser_read_buf(parser, data, len);
+    else
+        vt100_read_buf(parser, data, len);
+}
+
+/*
+** Sets the parser up in the arena, all parsers sharing one table of
+** callbacks.
+*/
+static struct lw_terminal *create_parser(struct lw_terminal_vt100 *this)
+{
+    struct lw_terminal *parser;
+
+    pthread_once(&callbacks_once, fill_callbacks);
+    parser = lw_terminal_parser_init_at(ARENA_PARSER(this->arena));
+    if (parser == NULL)
+        return NULL;
+    parser->cb = &callbacks;
+    parser->user_data = this;
+    parser->write = vt100_write;
+    parser->unimplemented = this->unimplemented;
+    parser->string = this->string;
+    parser->string_kinds = this->string_kinds;
+    return parser;
+}
+
+/*
+** PackBits: a byte n below 128 is followed by n + 1 bytes to copy, a
+** byte n above 128 by a byte to repeat 257 - n times. Idle screens
+** being mostly blank, this is all the compression they need.
+** dst must hold len + len / 128 + 1 bytes.
+*/
+static size_t pack(const char *src, size_t len, unsigned char *dst)
+{
+    size_t start;
+    size_t run;
+    size_t out;
+    size_t i;
+
+    i = out = 0;
+    while (i < len)
+    {
+        for (run = 1; i + run < len && run < 128 && src[i + run] == src[i];
+             ++run)
+            ;
+        if (run >= 3)
+        {
+            dst[out++] = 257 - run;
+            dst[out++] = src[i];
+            i += run;
+            continue ;
+        }
+        start = i;
+        while (i < len && i - start < 128
+               && !(i + 2 < len && src[i] == src[i + 1]
+                    && src[i] == src[i + 2]))
+            ++i;
+        dst[out++] = i - start - 1;
+        memcpy(dst + out, src + start, i - start);
+        out += i - start;
+    }
+    return out;
+}
+
+static void unpack(const unsigned char *src, size_t len, char *dst)
+{
+    size_t count;
+    size_t i;
+
+    i = 0;
+    while (i < len)
+    {
+        if (src[i] < 128)
+        {
+            count = src[i] + 1;
+            memcpy(dst, src + i + 1, count);
+            i += count + 1;
+        }
+        else
+        {
+            count = 257 - src[i];
+            memset(dst, src[i + 1], count);
+            i += 2;
+        }
+        dst += count;
+    }
+}
+
+/*
+** Packs the displayed rows and the tab stops into a blob and frees the
+** arena, parser included, leaving only the small state. Anything
+** touching the screen wakes the emulator up again, transparently.
+** Parser statistics start over on waking up.
+** Returns 0, or -1 if the parser is in the middle of a sequence or
+** memory is short, in which case nothing changes.
+*/
+int lw_terminal_vt100_hibernate(struct lw_terminal_vt100 *this)
+{
+    struct lw_terminal_vt100_hibernation *hibernation;
+    unsigned char *packed;
+    char *cells;
+    size_t size;
+    size_t raw;
+    unsigned int y;
+
+    pthread_mutex_lock(&this->mutex);
+    if (this->hibernation != NULL)
+    {
+        pthread_mutex_unlock(&this->mutex);
+        return 0;
+    }
+    if (this->lw_terminal->state != INIT)
+        goto fail;
+    raw = this->width * this->height + 132;
+    cells = malloc(raw);
+    packed = malloc(raw + raw / 128 + 1);
+    if (cells == NULL || packed == NULL)
+    {
+        free(cells);
+        free(packed);
+        goto fail;
+    }
+    for (y = 0; y < this->height; ++y)
+        memcpy(cells + y * this->width, lw_terminal_vt100_line(this, y),
+               this->width);
+    memcpy(cells + this->width * this->height, this->tabulations, 132);
+    size = pack(cells, raw, packed);
+    free(cells);
+    hibernation = malloc(sizeof(*hibernation) + size);
+    if (hibernation == NULL)
+    {
+        free(packed);
+        goto fail;
+    }
+    hibernation->size = size;
+    memcpy(hibernation->packed, packed, size);
+    free(packed);
+    this->hibernation_saved = arena_size(this->arena->rows)
+        - (sizeof(*hibernation) + hibernation->size);
+    lw_terminal_parser_destroy_at(this->lw_terminal);
+    rows_release(this);
+    /* Not pooled: the point is to give the memory back */
+    this->arena->unpooled = 1;
+    arena_release(arena_use(this, NULL));
+    this->lw_terminal = NULL;
+    this->hibernation = hibernation;
+    this->hibernations += 1;
+    pthread_mutex_unlock(&this->mutex);
+    return 0;
+fail:
+    pthread_mutex_unlock(&this->mutex);
+    return -1;
+}
+
+/*
+** Brings a hibernating emulator back.
+** Returns 0, or -1 if memory is short, the emulator staying asleep.
+*/
+static int resume(struct lw_terminal_vt100 *this)
+{
+    struct lw_terminal_vt100_arena *arena;
+    char *cells;
+    unsigned int y;
+
+    cells = malloc(this->width * this->height + 132);
+    if (cells == NULL)
+        return -1;
+    arena = arena_get(this->height);
+    if (arena == NULL)
+        goto free_cells;
+    arena_use(this, arena);
+    this->lw_terminal = create_parser(this);
+    if (this->lw_terminal == NULL)
+        goto put_arena;
+    unpack(this->hibernation->packed, this->hibernation->size, cells);
+    this->top_line = 0;
+    /* Rows show the same in both, whatever the margins */
+    rows_attach(this, arena);
+    for (y = 0; y < this->height; ++y)
+    {
+        memcpy(this->ring[y]->cells, cells + y * this->width, this->width);
+        memcpy(this->frozen[y]->cells, cells + y * this->width, this->width);
+    }
+    memcpy(this->tabulations, cells + this->width * this->height, 132);
+    free(cells);
+    free(this->hibernation);
+    this->hibernation = NULL;
+    this->hibernation_saved = 0;
+    this->resumes += 1;
+    return 0;
+put_arena:
+    arena_use(this, NULL);
+    arena_put(arena);
+free_cells:
+    free(cells);
+    return -1;
+}
+
 struct lw_terminal_vt100 *lw_terminal_vt100_init(void *user_data,
                                      void (*unimplemented)(struct lw_terminal* term_emul, char *seq, char chr))
 {
     struct lw_terminal_vt100 *this;
+    struct lw_terminal_vt100_arena *arena;
 
     this = calloc(1, sizeof(*this));
     if (this == NULL)
         return NULL;
     this->user_data = user_data;
     this->height = 24;
-    this->width = 80;
-    this->screen = malloc(132 * SCROLLBACK * this->height);
-    if (this->screen == NULL)
+    this->width = this->reset_width = 80;
+    this->unimplemented = unimplemented;
+    arena = arena_get(this->height);
+    if (arena == NULL)
         goto free_this;
-    memset(this->screen, ' ', 132 * SCROLLBACK * this->height);
-    this->frozen_screen = malloc(132 * this->height);
-    if (this->frozen_screen == NULL)
-        goto free_screen;
-    memset(this->frozen_screen, ' ', 132 * this->height);
-    this->tabulations = malloc(132);
-    if (this->tabulations == NULL)
-        goto free_frozen_screen;
-    if (this->tabulations == NULL)
-        return NULL;
-    this->margin_top = 0;
-    this->margin_bottom = this->height - 1;
-    this->selected_charset = 0;
-    this->x = 0;
-    this->y = 0;
-    this->modes = MASK_DECANM;
-    this->top_line = 0;
-    this->lw_terminal = lw_terminal_parser_init();
+    arena_use(this, arena);
+    this->lw_terminal = create_parser(this);
     if (this->lw_terminal == NULL)
-        goto free_tabulations;
-    this->lw_terminal->user_data = this;
-    this->lw_terminal->write = vt100_write;
-    this->lw_terminal->callbacks.csi.f = HVP;
-    this->lw_terminal->callbacks.csi.K = EL;
-    this->lw_terminal->callbacks.csi.c = DA;
-    this->lw_terminal->callbacks.csi.h = SM;
-    this->lw_terminal->callbacks.csi.l = RM;
-    this->lw_terminal->callbacks.csi.J = ED;
-    this->lw_terminal->callbacks.csi.H = CUP;
-    this->lw_terminal->callbacks.csi.C = CUF;
-    this->lw_terminal->callbacks.csi.B = CUD;
-    this->lw_terminal->callbacks.csi.r = DECSTBM;
-    this->lw_terminal->callbacks.csi.m = SGR;
-    this->lw_terminal->callbacks.csi.A = CUU;
-    this->lw_terminal->callbacks.csi.g = TBC;
-    this->lw_terminal->callbacks.esc.H = HTS;
-    this->lw_terminal->callbacks.csi.D = CUB;
-    this->lw_terminal->callbacks.esc.E = NEL;
-    this->lw_terminal->callbacks.esc.D = IND;
-    this->lw_terminal->callbacks.esc.M = RI;
-    this->lw_terminal->callbacks.esc.n8 = DECRC;
-    this->lw_terminal->callbacks.esc.n7 = DECSC;
-    this->lw_terminal->callbacks.hash.n8 = DECALN;
-    this->lw_terminal->unimplemented = unimplemented;
+        goto put_arena;
+    rows_attach(this, arena);
+    reset_state(this);
     return this;
-free_tabulations:
-    free(this->tabulations);
-free_frozen_screen:
-    free(this->frozen_screen);
-free_screen:
-    free(this->screen);
+put_arena:
+    arena_put(arena);
 free_this:
     free(this);
     return NULL;
 }
 
+/*
+** Copies an emulator in O(rows): the clone shares the parent's rows,
+** each row being copied by whichever side writes to it first, so only
+** rows that diverge take memory. The clone gets the screen, the modes,
+** the tab stops and the parser in the middle of whatever sequence it
+** is in, along with user_data, master_write, unimplemented and the
+** string callback, which may be changed before feeding it. Watches,
+** scrollback, lazy parsing and shared memory publication are not
+** inherited. Pointers from lw_terminal_vt100_getlines are only valid
+** until the next feed.
+** Returns NULL if memory is short.
+*/
+struct lw_terminal_vt100 *lw_terminal_vt100_clone(struct lw_terminal_vt100 *this)
+{
+    struct lw_terminal_vt100 *clone;
+    struct lw_terminal_vt100_arena *arena;
+    struct lw_terminal *parser;
+    unsigned int i;
+
+    clone = calloc(1, sizeof(*clone));
+    if (clone == NULL)
+        return NULL;
+    arena = arena_get(0);
+    if (arena == NULL)
+        goto free_clone;
+    arena_use(clone, arena);
+    clone->lw_terminal = create_parser(clone);
+    if (clone->lw_terminal == NULL)
+        goto put_arena;
+    pthread_mutex_lock(&this->mutex);
+    if (wake(this) == -1)
+    {
+        pthread_mutex_unlock(&this->mutex);
+        lw_terminal_parser_destroy_at(clone->lw_terminal);
+        goto put_arena;
+    }
+    clone->width = this->width;
+    clone->reset_width = this->reset_width;
+    clone->height = this->height;
+    clone->x = this->x;
+    clone->y = this->y;
+    clone->saved_x = this->saved_x;
+    clone->saved_y = this->saved_y;
+    clone->margin_top = this->margin_top;
+    clone->margin_bottom = this->margin_bottom;
+    clone->top_line = this->top_line;
+    clone->selected_charset = this->selected_charset;
+    clone->modes = this->modes;
+    clone->dynamic_dispatch = this->dynamic_dispatch;
+    clone->generation = this->generation;
+    memcpy(clone->line_generation, this->line_generation,
+           sizeof(clone->line_generation));
+    for (i = 0; i < SCROLLBACK * this->height; ++i)
+    {
+        clone->ring[i] = this->ring[i];
+        __atomic_add_fetch(&clone->ring[i]->refs, 1, __ATOMIC_RELAXED);
+    }
+    for (i = 0; i < this->height; ++i)
+    {
+        clone->frozen[i] = this->frozen[i];
+        __atomic_add_fetch(&clone->frozen[i]->refs, 1, __ATOMIC_RELAXED);
+    }
+    memcpy(clone->tabulations, this->tabulations, 132);
+    parser = clone->lw_terminal;
+    parser->cursor_pos_x = this->lw_terminal->cursor_pos_x;
+    parser->cursor_pos_y = this->lw_terminal->cursor_pos_y;
+    parser->state = this->lw_terminal->state;
+    parser->argc = this->lw_terminal->argc;
+    memcpy(parser->argv, this->lw_terminal->argv, sizeof(parser->argv));
+    parser->got_something = this->lw_terminal->got_something;
+    parser->flag = this->lw_terminal->flag;
+    parser->string_kind = this->lw_terminal->string_kind;
+    clone->master_write = this->master_write;
+    clone->user_data = this->user_data;
+    clone->unimplemented = this->unimplemented;
+    parser->unimplemented = this->lw_terminal->unimplemented;
+    clone->string = parser->string = this->string;
+    clone->string_kinds = parser->string_kinds = this->string_kinds;
+    pthread_mutex_unlock(&this->mutex);
+    return clone;
+put_arena:
+    arena_use(clone, NULL);
+    arena_put(arena);
+free_clone:
+    free(clone);
+    return NULL;
+}
+
+/*
+** Lazy parsing: with a budget set by lw_terminal_vt100_lazy, output is
+** only appended to pending until the budget is exceeded or the screen
+** is looked at, which are the only times it gets parsed. Output asking
+** for an answer (DA) is parsed at once, as the child may be waiting.
+** Emulators published to shared memory, keeping their scrollback
+** (scrolled_out) or watched are never lazy.
+**
+** Parsing pending output starts with a scan for the last point the
+** whole screen gets reset: RIS, or a home and an erase of the whole
+** display (ESC [ H ESC [ 2 J, or the other way around). What comes
+** before is skimmed: run through the parser with set() doing nothing,
+** so modes, margins, charsets, tab stops and the saved cursor are
+** tracked but no cell is written. Unless a tab stop or the saved cursor
+** depends on the cursor in there, text is not even looked at, except
+** for the SO and SI changing the charset. Output before a RIS is simply
+** dropped, RIS resetting all of that anyway.
+*/
+
+/*
+** Returns the offset right after the end of the sequence the parser is
+** in, given its state and the kind of string it may be reading,
+** following lw_terminal_parser_read.
+*/
+static size_t sequence_end(enum term_state state,
+                           enum lw_terminal_string_kind kind,
+                           const char *data, size_t pos, size_t len)
+{
+    const char *esc;
+    char c;
+
+    while (pos < len)
+    {
+        c = data[pos++];
+        if (state == ESC)
+        {
+            if (c == '[')
+                state = CSI;
+            else if (c == '#')
+                state = HASH;
+            else if (c == '(')
+                state = G0SET;
+            else if (c == ')')
+                state = G1SET;
+            else if (c == ']' || c == 'P' || c == '_' || c == '^' || c == 'X')
+            {
+                state = STRING;
+                kind = c == ']' ? STRING_OSC : STRING_DCS;
+            }
+            else if (c >= '0' && c <= 'z')
+                return pos;
+        }
+        else if (state == STRING)
+        {
+            if (c == '\007' && kind == STRING_OSC)
+                return pos;
+            if (c == '\033')
+                state = STRING_ST;
+            else if (kind != STRING_OSC)
+            {
+                esc = memchr(data + pos, '\033', len - pos);
+                pos = esc == NULL ? len : (size_t)(esc - data);
+            }
+        }
+        else if (state == STRING_ST)
+        {
+            if (c == '\\')
+                return pos;
+            /* The string ends there, the ESC starting a sequence */
+            state = ESC;
+            pos -= 1;
+        }
+        else if (state == HASH)
+        {
+            if (c >= '0' && c <= '9')
+                return pos;
+        }
+        else if (state == CSI)
+        {
+            if (c > '?' && c <= 'z')
+                return pos;
+        }
+        else if (state != INIT)
+            return pos;
+    }
+    return len;
+}
+
+/*
+** Returns the offset of the last reset point, 0 if there is none, and
+** whether text can be skipped in front of it. Sequences are followed
+** from the state the parser is in, so only escapes starting a sequence
+** count.
+*/
+static size_t find_reset(const char *data, size_t len,
+                         enum term_state state,
+                         enum lw_terminal_string_kind kind, int *skip_text)
+{
+    const char *esc;
+    size_t cursor;
+    size_t reset;
+    size_t pos;
+    size_t end;
+
+    reset = 0;
+    cursor = len;
+    pos = state == INIT ? 0 : sequence_end(state, kind, data, 0, len);
+    while (pos < len
+           && (esc = memchr(data + pos, '\033', len - pos)) != NULL)
+    {
+        pos = esc - data;
+        end = sequence_end(ESC, kind, data, pos + 1, len);
+        if (end == pos + 2 && esc[1] == 'c')
+            reset = pos;
+        else if (len - pos >= 7 && (memcmp(esc, "\033[H\033[2J", 7) == 0
+                                    || memcmp(esc, "\033[2J\033[H", 7) == 0))
+            reset = pos;
+        else if (cursor == len
+                 && ((end == pos + 2 && (esc[1] == 'H' || esc[1] == '7'))
+                     || (end > pos + 2 && esc[1] == '['
+                         && data[end - 1] == 'g')))
+            cursor = pos;
+        pos = end;
+    }
+    *skip_text = cursor >= reset;
+    return reset;
+}
+
+static void skim(struct lw_terminal_vt100 *this,
+                 const char *data, size_t len, int skip_text)
+{
+    struct lw_terminal *parser;
+    const char *end;
+    const char *next;
+    const char *c;
+
+    parser = this->lw_terminal;
+    end = data + len;
+    this->skimming = 1;
+    while (data < end)
+    {
+        if (parser->state == STRING)
+        {
+            next = memchr(data, '\033', end - data);
+            next = next == NULL ? end : next + 1;
+            parse(this, data, next - data);
+            data = next;
+            continue ;
+        }
+        if (!skip_text || parser->state != INIT || *data == '\033')
+        {
+            parse(this, data++, 1);
+            continue ;
+        }
+        next = memchr(data, '\033', end - data);
+        if (next == NULL)
+            next = end;
+        for (c = next; c > data; )
+            if (*--c == '\016' || *c == '\017')
+            {
+                parse(this, c, 1);
+                break ;
+            }
+        data = next;
+    }
+    this->skimming = 0;
+}
+
+/*
+** Parses the pending output, called with the mutex held, awake.
+*/
+static void flush(struct lw_terminal_vt100 *this)
+{
+    size_t reset;
+    size_t len;
+    int skip_text;
+
+    len = this->pending_len;
+    this->pending_len = 0;
+    this->generation += 1;
+    reset = find_reset(this->pending, len, this->lw_terminal->state,
+                       this->lw_terminal->string_kind, &skip_text);
+    if (reset > 0)
+    {
+        if (this->pending[reset + 1] != 'c')
+            skim(this, this->pending, reset, skip_text);
+        lw_terminal_parser_reset(this->lw_terminal);
+        this->elided += reset;
+    }
+    parse(this, this->pending + reset, len - reset);
+}
+
+/*
+** Makes the emulator ready to be read or fed: brings it back from
+** hibernation, then parses what lazy parsing left pending. Called with
+** the mutex held. Returns 0, or -1 if memory is short.
+*/
+static int wake(struct lw_terminal_vt100 *this)
+{
+    if (this->hibernation != NULL && resume(this) == -1)
+        return -1;
+    if (this->pending_len > 0)
+        flush(this);
+    return 0;
+}
+
+/*
+** Whether the output asks for an answer (DA, ESC [ c or ESC [ 0 c).
+*/
+static int wants_answer(const char *buffer, size_t len)
+{
+    const char *esc;
+    const char *end;
+
+    end = buffer + len;
+    esc = buffer;
+    while ((esc = memchr(esc, '\033', end - esc)) != NULL)
+    {
+        if (end - esc >= 3 && esc[1] == '['
+            && (esc[2] == 'c' || (end - esc >= 4 && esc[2] == '0'
+                                  && esc[3] == 'c')))
+            return 1;
+        esc += 1;
+    }
+    return 0;
+}
+
+/*
+** Whether a DA would straddle what is pending and buffer, or the
+** sequence the parser is in when nothing is pending.
+*/
+static int seam_wants_answer(struct lw_terminal_vt100 *this,
+                             const char *buffer, size_t len)
+{
+    char seam[6];
+    size_t tail;
+    size_t head;
+
+    /* Hibernating emulators have no parser, being in INIT to sleep */
+    if (this->pending_len == 0)
+        return this->lw_terminal != NULL && this->lw_terminal->state != INIT;
+    tail = this->pending_len < 3 ? this->pending_len : 3;
+    head = len < 3 ? len : 3;
+    memcpy(seam, this->pending + this->pending_len - tail, tail);
+    memcpy(seam + tail, buffer, head);
+    return wants_answer(seam, tail + head);
+}
+
+static int defer(struct lw_terminal_vt100 *this,
+                 const char *buffer, size_t len)
+{
+    size_t size;
+    char *pending;
+
+    if (this->lazy_budget == 0 || this->shm != NULL
+        || this->scrolled_out != NULL || this->watches != NULL
+        || this->string != NULL
+        || this->pending_len + len > this->lazy_budget
+        || wants_answer(buffer, len) || seam_wants_answer(this, buffer, len))
+        return 0;
+    if (this->pending_len + len > this->pending_size)
+    {
+        for (size = this->pending_size ? this->pending_size : 4096;
+             size < this->pending_len + len; size *= 2)
+            ;
+        if (size > this->lazy_budget)
+            size = this->lazy_budget;
+        pending = realloc(this->pending, size);
+        if (pending == NULL)
+            return 0;
+        this->pending = pending;
+        this->pending_size = size;
+    }
+    memcpy(this->pending + this->pending_len, buffer, len);
+    this->pending_len += len;
+    return 1;
+}
+
+/*
+** Sets the budget of lazy parsing, in bytes, see above. 0 parses what
+** is pending and goes back to parsing everything at once.
+*/
+void lw_terminal_vt100_lazy(struct lw_terminal_vt100 *this, size_t budget)
+{
+    pthread_mutex_lock(&this->mutex);
+    this->lazy_budget = budget;
+    if (budget == 0 && wake(this) == 0)
+    {
+        free(this->pending);
+        this->pending = NULL;
+        this->pending_size = 0;
+    }
+    pthread_mutex_unlock(&this->mutex);
+}
+
+/*
+** Hands the payload of control strings of the given kinds, a mask of
+** 1 << STRING_OSC and such, to callback, or to nobody if it is NULL,
+** see lw_terminal_parser.h. The emulator is term_emul->user_data.
+** Lazy parsing is off while it is set, so strings come as they are
+** output.
+*/
+void lw_terminal_vt100_strings(struct lw_terminal_vt100 *this,
+                               unsigned int kinds,
+                               void (*callback)(struct lw_terminal *term_emul,
+                                                enum lw_terminal_string_kind kind,
+                                                const char *chunk,
+                                                size_t len, int final))
+{
+    pthread_mutex_lock(&this->mutex);
+    this->string = callback;
+    this->string_kinds = kinds;
+    if (this->lw_terminal != NULL)
+    {
+        this->lw_terminal->string = callback;
+        this->lw_terminal->string_kinds = kinds;
+    }
+    pthread_mutex_unlock(&this->mutex);
+}
+
+/*
+** Parses the pending output, for readers of generation, line_generation
+** or the cursor, which don't go through a function doing it for them.
+*/
+void lw_terminal_vt100_flush(struct lw_terminal_vt100 *this)
+{
+    pthread_mutex_lock(&this->mutex);
+    if (this->pending_len > 0 && wake(this) == 0 && this->shm != NULL)
+        publish(this);
+    pthread_mutex_unlock(&this->mutex);
+}
+
+/*
+** Watches: lw_terminal_vt100_watch registers a rectangle, rows top to
+** bottom and columns left to right included, whose callback gets each
+** row of it whose text changed, once the output that changed it is
+** parsed. Rows count the watches covering them, so writes to unwatched
+** rows only cost a look at that count; writes to watched rows flag the
+** row, and after parsing only flagged rows are compared to what the
+** callbacks last got. Rectangles may extend beyond the screen, what is
+** beyond is left out.
+**
+** Watches are added and removed, and callbacks run, in the thread
+** feeding the emulator, which is unlocked by then. The text passed
+** points into the screen, valid until the next feed. Callbacks may
+** remove watches, theirs included.
+*/
+static void fire_watches(struct lw_terminal_vt100 *this)
+{
+    struct lw_terminal_vt100_watch **link;
+    struct lw_terminal_vt100_watch *watch;
+    const char *text;
+    char *shown;
+    unsigned int len;
+    unsigned int y;
+
+    if (!this->watch_pending || this->firing)
+        return ;
+    this->watch_pending = 0;
+    this->firing = 1;
+    for (watch = this->watches; watch != NULL; watch = watch->next)
+        for (y = watch->top; y <= watch->bottom && y < this->height; ++y)
+        {
+            if (watch->removed || !this->watch_dirty[y]
+                || watch->left >= this->width)
+                continue ;
+            len = (watch->right < this->width ? watch->right + 1
+                                              : this->width) - watch->left;
+            text = lw_terminal_vt100_line(this, y) + watch->left;
+            shown = watch->shown
+                + (y - watch->top) * (watch->right - watch->left + 1);
+            if (memcmp(shown, text, len) == 0)
+                continue ;
+            memcpy(shown, text, len);
+            watch->callback(this, watch->id, y, watch->left, text, len,
+                            watch->user_data);
+        }
+    memset(this->watch_dirty, 0, sizeof(this->watch_dirty));
+    this->firing = 0;
+    for (link = &this->watches; *link != NULL; )
+    {
+        watch = *link;
+        if (watch->removed)
+        {
+            *link = watch->next;
+            free(watch);
+        }
+        else
+            link = &watch->next;
+    }
+}
+
+/*
+** Watches a rectangle of the screen, see above. Returns the id of the
+** watch, or -1 if the rectangle is not within 132 columns and 80 rows
+** or memory is short.
+*/
+int lw_terminal_vt100_watch(struct lw_terminal_vt100 *this,
+                            unsigned int top, unsigned int left,
+                            unsigned int bottom, unsigned int right,
+                            lw_terminal_vt100_watcher callback,
+                            void *user_data)
+{
+    struct lw_terminal_vt100_watch *watch;
+    unsigned int columns;
+    unsigned int y;
+
+    if (top > bottom || bottom >= 80 || left > right || right >= 132)
+        return -1;
+    columns = right - left + 1;
+    watch = malloc(sizeof(*watch) + (bottom - top + 1) * columns);
+    if (watch == NULL)
+        return -1;
+    watch->top = top;
+    watch->left = left;
+    watch->bottom = bottom;
+    watch->right = right;
+    watch->callback = callback;
+    watch->user_data = user_data;
+    watch->removed = 0;
+    memset(watch->shown, ' ', (bottom - top + 1) * columns);
+    pthread_mutex_lock(&this->mutex);
+    if (wake(this) == -1)
+    {
+        pthread_mutex_unlock(&this->mutex);
+        free(watch);
+        return -1;
+    }
+    for (y = top; y <= bottom; ++y)
+    {
+        if (y < this->height && left < this->width)
+            memcpy(watch->shown + (y - top) * columns,
+                   lw_terminal_vt100_line(this, y) + left,
+                   (right < this->width ? right + 1 : this->width) - left);
+        this->watched[y] += 1;
+    }
+    watch->id = ++this->watch_ids;
+    watch->next = this->watches;
+    this->watches = watch;
+    pthread_mutex_unlock(&this->mutex);
+    return watch->id;
+}
+
+void lw_terminal_vt100_unwatch(struct lw_terminal_vt100 *this, int id)
+{
+    struct lw_terminal_vt100_watch **link;
+    struct lw_terminal_vt100_watch *watch;
+    unsigned int y;
+
+    pthread_mutex_lock(&this->mutex);
+    for (link = &this->watches; *link != NULL; link = &(*link)->next)
+        if ((*link)->id == id && !(*link)->removed)
+            break ;
+    watch = *link;
+    if (watch != NULL)
+    {
+        for (y = watch->top; y <= watch->bottom; ++y)
+            this->watched[y] -= 1;
+        if (this->firing)
+            watch->removed = 1;
+        else
+        {
+            *link = watch->next;
+            free(watch);
+        }
+    }
+    pthread_mutex_unlock(&this->mutex);
+}
+
 void lw_terminal_vt100_read_str(struct lw_terminal_vt100 *this, char *buffer)
+{
+    lw_terminal_vt100_read_buf(this, buffer, strlen(buffer));
+}
+
+void lw_terminal_vt100_read_buf(struct lw_terminal_vt100 *this,
+                                const char *buffer, size_t len)
 {
     pthread_mutex_lock(&this->mutex);
-    lw_terminal_parser_read_str(this->lw_terminal, buffer);
+    if (defer(this, buffer, len))
+    {
+        pthread_mutex_unlock(&this->mutex);
+        return ;
+    }
+    if (wake(this) == -1)
+    {
+        pthread_mutex_unlock(&this->mutex);
+        return ;
+    }
+    this->generation += 1;
+    parse(this, buffer, len);
+    if (this->shm != NULL)
+        publish(this);
     pthread_mutex_unlock(&this->mutex);
+    fire_watches(this);
 }
 
 void lw_terminal_vt100_destroy(struct lw_terminal_vt100 *this)
 {
-    lw_terminal_parser_destroy(this->lw_terminal);
-    free(this->screen);
-    free(this->frozen_screen);
+    struct lw_terminal_vt100_watch *watch;
+
+    vt100_shm_unpublish(this);
+    if (this->arena != NULL)
+    {
+        lw_terminal_parser_destroy_at(this->lw_terminal);
+        rows_release(this);
+        arena_release(this->arena);
+    }
+    while (this->watches != NULL)
+    {
+        watch = this->watches;
+        this->watches = watch->next;
+        free(watch);
+    }
+    free(this->hibernation);
+    free(this->pending);
     free(this);
 }
@@ -29,6 +29,43 @@
 #include <pthread.h>
 #include "lw_terminal_parser.h"
 
+struct vt100_shm;
+struct lw_terminal_vt100_arena;
+struct lw_terminal_vt100_row;
+struct lw_terminal_vt100;
+
+/*
+** Gets the text of a watched row, from column to column + len - 1,
+** straight from the screen, see lw_terminal_vt100_watch.
+*/
+typedef void (*lw_terminal_vt100_watcher)(struct lw_terminal_vt100 *vt100,
+                                          int id, unsigned int row,
+                                          unsigned int column,
+                                          const char *text, unsigned int len,
+                                          void *user_data);
+
+/* A rectangle of the screen, see lw_terminal_vt100_watch */
+struct lw_terminal_vt100_watch
+{
+    int           id;
+    unsigned int  top;
+    unsigned int  left;
+    unsigned int  bottom;
+    unsigned int  right;
+    lw_terminal_vt100_watcher callback;
+    void          *user_data;
+    int           removed; /* Freed once the callbacks are done */
+    struct lw_terminal_vt100_watch *next;
+    char          shown[1]; /* What the callback last got, row by row */
+};
+
+/* A hibernating emulator's screen, see lw_terminal_vt100_hibernate */
+struct lw_terminal_vt100_hibernation
+{
+    size_t        size;
+    unsigned char packed[1];
+};
+
 /*
  * Source : http://vt100.net/docs/vt100-ug/chapter3.html
             http://vt100.net/docs/tp83/appendixb.html
@@ -65,16 +102,18 @@
 #define MODE_IS_SET(vt100, mode) ((vt100)->modes & get_mode_mask(mode))
 
 /*
-** frozen_screen is the frozen part of the screen
+** frozen is the frozen part of the screen
 ** when margins are set.
-** The top of the frozen_screen holds the top margin
+** The top of frozen holds the top margin
 ** while the bottom holds the bottom margin.
+** Rows are shared copy-on-write with clones, see lw_terminal_vt100_clone.
 */
 struct lw_terminal_vt100
 {
     struct lw_terminal *lw_terminal;
     unsigned int width;
     unsigned int height;
+    unsigned int reset_width; /* Set by resize, DECCOLM aside, for RIS */
     unsigned int x;
     unsigned int y;
     unsigned int saved_x;
@@ -82,15 +121,46 @@ struct lw_terminal_vt100
     unsigned int margin_top;
     unsigned int margin_bottom;
     unsigned int top_line; /* Line at the top of the display */
-    char         *screen;
-    char         *frozen_screen;
+    struct lw_terminal_vt100_row *ring[SCROLLBACK * 80];
+    struct lw_terminal_vt100_row *frozen[80];
     char         *tabulations;
     unsigned int selected_charset;
     unsigned int modes;
     char         *lines[80];
+    unsigned int generation; /* Bumped on every read */
+    unsigned int line_generation[80]; /* Generation of last change */
     void         (*master_write)(void *user_data, void *buffer, size_t len);
     void         *user_data;
     pthread_mutex_t mutex;
+    struct vt100_shm *shm; /* See vt100_shm.h, NULL if not published */
+    void         (*unimplemented)(struct lw_terminal *term_emul,
+                                  char *seq, char chr);
+    /* Gets control strings, see lw_terminal_vt100_strings */
+    void         (*string)(struct lw_terminal *term_emul,
+                           enum lw_terminal_string_kind kind,
+                           const char *chunk, size_t len, int final);
+    unsigned int string_kinds;
+    struct lw_terminal_vt100_hibernation *hibernation; /* NULL if awake */
+    size_t       hibernation_saved; /* Bytes freed by hibernating */
+    unsigned long hibernations;
+    unsigned long resumes;
+    struct lw_terminal_vt100_arena *arena; /* NULL while hibernating */
+    char         *pending; /* Output not parsed yet, see lw_terminal_vt100_lazy */
+    size_t       pending_len;
+    size_t       pending_size;
+    size_t       lazy_budget; /* 0 to parse output as it comes */
+    int          skimming; /* Parsing without writing cells */
+    int          dynamic_dispatch; /* Parse through the callbacks table */
+    unsigned long elided; /* Bytes skimmed or dropped by lazy parsing */
+    /* Gets the lines scrolling off the top of the screen, may be NULL */
+    void         (*scrolled_out)(void *user_data, const char *line,
+                                 unsigned int width);
+    struct lw_terminal_vt100_watch *watches;
+    int          watch_ids;
+    unsigned int watched[80]; /* Watches covering each row */
+    unsigned char watch_dirty[80]; /* Watched rows written to */
+    int          watch_pending; /* Some watch_dirty is set */
+    int          firing; /* Watch callbacks are running */
 };
 
 struct lw_terminal_vt100 *lw_terminal_vt100_init(void *user_data,
@@ -98,7 +168,33 @@ struct lw_terminal_vt100 *lw_terminal_vt100_init(void *user_data,
                                                            char *seq, char chr));
 char lw_terminal_vt100_get(struct lw_terminal_vt100 *vt100, unsigned int x, unsigned int y);
 const char **lw_terminal_vt100_getlines(struct lw_terminal_vt100 *vt100);
+unsigned int lw_terminal_vt100_copy_screen(struct lw_terminal_vt100 *vt100,
+                                           char *buffer);
+struct lw_terminal_vt100 *lw_terminal_vt100_clone(struct lw_terminal_vt100 *this);
 void lw_terminal_vt100_destroy(struct lw_terminal_vt100 *this);
+void lw_terminal_vt100_reset(struct lw_terminal_vt100 *this);
+int lw_terminal_vt100_resize(struct lw_terminal_vt100 *this,
+                             unsigned int width, unsigned int height);
+void lw_terminal_vt100_publish(struct lw_terminal_vt100 *vt100);
+int lw_terminal_vt100_hibernate(struct lw_terminal_vt100 *this);
+void lw_terminal_vt100_lazy(struct lw_terminal_vt100 *this, size_t budget);
+void lw_terminal_vt100_flush(struct lw_terminal_vt100 *this);
+void lw_terminal_vt100_strings(struct lw_terminal_vt100 *this,
+                               unsigned int kinds,
+                               void (*callback)(struct lw_terminal *term_emul,
+                                                enum lw_terminal_string_kind kind,
+                                                const char *chunk,
+                                                size_t len, int final));
+int lw_terminal_vt100_watch(struct lw_terminal_vt100 *this,
+                            unsigned int top, unsigned int left,
+                            unsigned int bottom, unsigned int right,
+                            lw_terminal_vt100_watcher callback,
+                            void *user_data);
+void lw_terminal_vt100_unwatch(struct lw_terminal_vt100 *this, int id);
+int lw_terminal_vt100_stats(struct lw_terminal_vt100 *vt100,
+                            struct lw_terminal_stats *stats);
 void lw_terminal_vt100_read_str(struct lw_terminal_vt100 *this, char *buffer);
+void lw_terminal_vt100_read_buf(struct lw_terminal_vt100 *this,
+                                const char *buffer, size_t len);
 
 #endif
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "lw_terminal_vt100.h"
+
+/*
+** Compares the parser specialized for the emulator, its actions called
+** directly, with the parser going through the callbacks table.
+**
+** Usage: parser_bench [-n ROUNDS] [FILE]
+**
+** Feeds FILE, raw terminal output, in 4KB chunks to an emulator of
+** each kind, ROUNDS times (10 by default), printing the best
+** throughput of each. Without FILE, a full screen application redrawing colored
+** lines is made up.
+*/
+
+#define CHUNK 4096
+
+static void discard(void *user_data, void *buffer, size_t len)
+{
+    (void)user_data;
+    (void)buffer;
+    (void)len;
+}
+
+static char *make_up(size_t *len)
+{
+    char *output;
+    size_t size;
+    unsigned int frame;
+    unsigned int y;
+
+    size = 0;
+    output = malloc(1 << 23);
+    if (output == NULL)
+        return NULL;
+    for (frame = 0; size < (1 << 23) - 4096; ++frame)
+        for (y = 1; y <= 24 && size < (1 << 23) - 4096; ++y)
+            size += sprintf(output + size, "\033[%u;1H\033[1;%um%4u\033[0m "
+                            "frame %u: the quick brown fox jumps over the "
+                            "lazy dog\033[K\r\n", y, 31 + y % 7, y, frame);
+    *len = size;
+    return output;
+}
+
+static char *load(const char *path, size_t *len)
+{
+    FILE *file;
+    char *output;
+    long size;
+
+    file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+    output = NULL;
+    if (fseek(file, 0, SEEK_END) == -1 || (size = ftell(file)) <= 0
+        || fseek(file, 0, SEEK_SET) == -1)
+        goto close;
+    output = malloc(size);
+    if (output != NULL && fread(output, 1, size, file) != (size_t)size)
+    {
+        free(output);
+        output = NULL;
+    }
+    *len = size;
+close:
+    fclose(file);
+    return output;
+}
+
+static struct lw_terminal_vt100 *create(int dynamic_dispatch)
+{
+    struct lw_terminal_vt100 *vt100;
+
+    vt100 = lw_terminal_vt100_init(NULL, NULL);
+    if (vt100 == NULL)
+        return NULL;
+    vt100->master_write = discard;
+    vt100->dynamic_dispatch = dynamic_dispatch;
+    return vt100;
+}
+
+/*
+** Feeds the whole output once, returning the time it took.
+*/
+static double feed(struct lw_terminal_vt100 *vt100,
+                   const char *output, size_t len)
+{
+    struct timespec start;
+    struct timespec end;
+    size_t done;
+    size_t chunk;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (done = 0; done < len; done += chunk)
+    {
+        chunk = len - done < CHUNK ? len - done : CHUNK;
+        lw_terminal_vt100_read_buf(vt100, output + done, chunk);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+int main(int ac, char **av)
+{
+    static char screens[2][132 * 80];
+    struct lw_terminal_vt100 *vt100[2];
+    double best[2];
+    double seconds;
+    unsigned int rounds;
+    unsigned int round;
+    unsigned int i;
+    char *output;
+    size_t len;
+    int opt;
+
+    rounds = 10;
+    while ((opt = getopt(ac, av, "n:")) != -1)
+    {
+        if (opt == 'n')
+            rounds = atoi(optarg);
+        else
+            goto usage;
+    }
+    if (optind < ac - 1 || rounds == 0)
+        goto usage;
+    output = optind < ac ? load(av[optind], &len) : make_up(&len);
+    if (output == NULL)
+    {
+        perror(optind < ac ? av[optind] : "malloc");
+        return EXIT_FAILURE;
+    }
+    vt100[0] = create(1);
+    vt100[1] = create(0);
+    if (vt100[0] == NULL || vt100[1] == NULL)
+        return EXIT_FAILURE;
+    best[0] = best[1] = 0;
+    /* Taking turns, so both get the same share of noise */
+    for (round = 0; round < rounds; ++round)
+        for (i = 0; i < 2; ++i)
+        {
+            seconds = feed(vt100[i], output, len);
+            if (best[i] == 0 || seconds < best[i])
+                best[i] = seconds;
+        }
+    printf("%lu bytes, best of %u rounds\n", (unsigned long)len, rounds);
+    printf("callbacks table: %8.2f MB/s\n", len / 1e6 / best[0]);
+    printf("specialized:     %8.2f MB/s (x%.2f)\n", len / 1e6 / best[1],
+           best[0] / best[1]);
+    for (i = 0; i < 2; ++i)
+    {
+        lw_terminal_vt100_copy_screen(vt100[i], screens[i]);
+        lw_terminal_vt100_destroy(vt100[i]);
+    }
+    if (memcmp(screens[0], screens[1], sizeof(screens[0])) != 0)
+        printf("The screens differ!\n");
+    free(output);
+    return EXIT_SUCCESS;
+usage:
+    fprintf(stderr, "Usage: %s [-n ROUNDS] [FILE]\n", av[0]);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include "hl_vt100.h"
+
+/*
+** Measures sustained parsing throughput.
+**
+** Usage: pipeline_bench [-p] [-r RING_KB] PROGRAM [ARGS...]
+**
+**     pipeline_bench cat /usr/share/dict/words
+**     pipeline_bench -p cat /usr/share/dict/words
+**
+** Runs PROGRAM in a session until it exits, then prints how many MB it
+** wrote and how fast they were parsed. With -p the session reads
+** through the pipeline of hl_vt100_pipeline.h, with a ring of RING_KB
+** kilobytes, and the ring statistics are printed too.
+*/
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int ac, char **av)
+{
+    struct vt100_headless *vt100;
+    struct vt100_pipeline pipeline;
+    size_t ring_size;
+    double seconds;
+    double megabytes;
+    int use_pipeline;
+    int opt;
+
+    use_pipeline = 0;
+    ring_size = 0;
+    while ((opt = getopt(ac, av, "pr:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p': use_pipeline = 1; break ;
+        case 'r': ring_size = strtoul(optarg, NULL, 10) * 1024; break ;
+        default: goto usage;
+        }
+    }
+    if (optind == ac)
+        goto usage;
+    vt100 = new_vt100_headless();
+    if (vt100 == NULL)
+        return EXIT_FAILURE;
+    vt100->detached = 1;
+    seconds = now();
+    if (vt100_headless_spawn(vt100, av[optind], av + optind) == -1)
+    {
+        perror(av[optind]);
+        return EXIT_FAILURE;
+    }
+    if (use_pipeline && vt100_headless_pipeline_start(vt100, ring_size) == -1)
+    {
+        fprintf(stderr, "Can't start the pipeline\n");
+        return EXIT_FAILURE;
+    }
+    while (vt100_headless_poll(vt100, -1) != -1)
+        if (vt100->pipeline != NULL)
+            pipeline = *vt100->pipeline;
+    seconds = now() - seconds;
+    megabytes = vt100->metrics.bytes_read / 1e6;
+    printf("%.1f MB, %.3fs, %.1f MB/s\n", megabytes, seconds,
+           megabytes / seconds);
+    if (use_pipeline)
+        printf("ring %lu KB, high water %lu KB, %lu reads of %.0f bytes"
+               " on average, %lu batches, %lu waits for room\n",
+               (unsigned long)pipeline.size / 1024,
+               (unsigned long)pipeline.high_water / 1024, pipeline.reads,
+               pipeline.reads ? vt100->metrics.bytes_read
+               / (double)pipeline.reads : 0.0,
+               pipeline.batches, pipeline.full);
+    delete_vt100_headless(vt100);
+    return EXIT_SUCCESS;
+usage:
+    fprintf(stderr, "Usage: %s [-p] [-r RING_KB] PROGRAM [ARGS...]\n",
+            av[0]);
+    return EXIT_FAILURE;
+}
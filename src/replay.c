@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+#include "hl_vt100.h"
+
+/*
+** Feeds a log recorded by vt100_headless_record through a vt100_headless
+** whose clock is the log's virtual time, either as fast as possible
+** (default) or with the recorded pace (-r).
+** With -s, prints the parser statistics (needs a STATS=1 build).
+*/
+
+static void print_stats(struct lw_terminal_vt100 *vt100)
+{
+    static const char *kinds[] = {"ESC", "CSI", "HASH", "SCS"};
+    struct lw_terminal_stats stats;
+    unsigned int kind;
+    unsigned int c;
+    unsigned int bucket;
+
+    if (lw_terminal_vt100_stats(vt100, &stats) == -1)
+    {
+        fprintf(stderr, "Parser statistics are not built in, "
+                "build with make STATS=1\n");
+        return ;
+    }
+    fprintf(stderr, "%lu writes, %lu unimplemented, %lu param overflows\n",
+            stats.writes, stats.unimplemented, stats.param_overflows);
+    for (kind = 0; kind < STATS_KINDS; ++kind)
+        for (c = 0; c < LW_TERMINAL_STATS_FINALS; ++c)
+        {
+            if (stats.dispatched[kind][c] == 0)
+                continue ;
+            fprintf(stderr, "%-4s %c %10lu  ns log2 histogram:", kinds[kind],
+                    c + '0', stats.dispatched[kind][c]);
+            for (bucket = 0; bucket < LW_TERMINAL_STATS_BUCKETS;
+                 ++bucket)
+                fprintf(stderr, " %u", stats.histogram[kind][c][bucket]);
+            fprintf(stderr, "\n");
+        }
+}
+
+static unsigned long replay_clock(void *clock_data)
+{
+    return ((struct vt100_replay *)clock_data)->clock_usec;
+}
+
+static double elapsed(struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec)
+        + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void disp(struct vt100_headless *vt100)
+{
+    unsigned int y;
+    const char **lines;
+
+    lines = vt100_headless_getlines(vt100);
+    for (y = 0; y < vt100->term->height; ++y)
+    {
+        write(1, "|", 1);
+        write(1, lines[y], vt100->term->width);
+        write(1, "|\n", 2);
+    }
+}
+
+int main(int ac, char **av)
+{
+    struct vt100_headless *vt100_headless;
+    struct vt100_replay *replay;
+    struct timespec start;
+    struct timespec delay;
+    unsigned long delta;
+    unsigned long chunks;
+    unsigned long bytes;
+    const char *data;
+    size_t len;
+    double seconds;
+    int realtime;
+    int statistics;
+    int opt;
+    int ret;
+
+    realtime = statistics = 0;
+    while ((opt = getopt(ac, av, "rs")) != -1)
+    {
+        if (opt == 'r')
+            realtime = 1;
+        else if (opt == 's')
+            statistics = 1;
+        else
+            goto usage;
+    }
+    if (optind != ac - 1)
+        goto usage;
+    replay = vt100_replay_open(av[optind]);
+    if (replay == NULL)
+    {
+        perror(av[optind]);
+        return EXIT_FAILURE;
+    }
+    vt100_headless = new_vt100_headless();
+    if (vt100_headless == NULL)
+        return EXIT_FAILURE;
+    vt100_headless->clock = replay_clock;
+    vt100_headless->clock_data = replay;
+    chunks = bytes = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while ((ret = vt100_replay_next(replay, &delta, &data, &len)) == 1)
+    {
+        if (realtime && delta > 0)
+        {
+            delay.tv_sec = delta / 1000000;
+            delay.tv_nsec = (delta % 1000000) * 1000;
+            nanosleep(&delay, NULL);
+        }
+        vt100_headless_feed(vt100_headless, data, len);
+        chunks += 1;
+        bytes += len;
+    }
+    seconds = elapsed(&start);
+    if (ret == -1)
+        fprintf(stderr, "%s: truncated or corrupted log\n", av[optind]);
+    disp(vt100_headless);
+    fprintf(stderr, "%lu chunks, %lu bytes, %.3fs recorded, %.3fs replayed,"
+            " %.2f MB/s\n", chunks, bytes, replay->clock_usec / 1e6, seconds,
+            seconds > 0 ? bytes / seconds / 1e6 : 0);
+    if (statistics)
+        print_stats(vt100_headless->term);
+    delete_vt100_headless(vt100_headless);
+    vt100_replay_close(replay);
+    return ret == -1 ? EXIT_FAILURE : EXIT_SUCCESS;
+usage:
+    fprintf(stderr, "Usage: %s [-r] [-s] LOG\n", av[0]);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include "hl_vt100.h"
+
+/*
+** Measures how fast sessions start.
+**
+** Usage: spawn_bench [-n SPAWNS] [-c CONCURRENT] [-f] [COMMAND [ARGS]]
+**
+** Starts SPAWNS sessions of COMMAND ("echo ready" by default), keeping
+** CONCURRENT of them running at once, each one being read until its
+** child exits. Prints the sessions started per second and the
+** distribution of the time to first byte, from the start of the spawn
+** to the first output parsed. With -f, sessions are started with
+** vt100_headless_fork instead of vt100_headless_spawn.
+*/
+
+struct session
+{
+    struct vt100_headless *vt100;
+    double                start;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x;
+    double y;
+
+    x = *(const double *)a;
+    y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int start(struct session *session, int use_fork, char **argv)
+{
+    session->vt100 = new_vt100_headless();
+    if (session->vt100 == NULL)
+        return -1;
+    session->vt100->detached = 1;
+    session->start = now();
+    if (use_fork)
+        vt100_headless_fork(session->vt100, argv[0], argv);
+    else if (vt100_headless_spawn(session->vt100, argv[0], argv) == -1)
+        perror(argv[0]);
+    if (session->vt100->master != -1)
+        return 0;
+    delete_vt100_headless(session->vt100);
+    session->vt100 = NULL;
+    return -1;
+}
+
+int main(int ac, char **av)
+{
+    static char *echo[] = {"echo", "ready", NULL};
+    struct session *sessions;
+    struct pollfd *fds;
+    unsigned long nspawns;
+    unsigned long nsessions;
+    unsigned long started;
+    unsigned long done;
+    unsigned long ttfb_count;
+    unsigned long i;
+    double *ttfb;
+    double seconds;
+    char **argv;
+    int use_fork;
+    int opt;
+
+    nspawns = 1000;
+    nsessions = 16;
+    use_fork = 0;
+    while ((opt = getopt(ac, av, "n:c:f")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n': nspawns = strtoul(optarg, NULL, 10); break ;
+        case 'c': nsessions = strtoul(optarg, NULL, 10); break ;
+        case 'f': use_fork = 1; break ;
+        default: goto usage;
+        }
+    }
+    if (nspawns == 0 || nsessions == 0)
+        goto usage;
+    argv = optind < ac ? av + optind : echo;
+    sessions = calloc(nsessions, sizeof(*sessions));
+    fds = calloc(nsessions, sizeof(*fds));
+    ttfb = calloc(nspawns, sizeof(*ttfb));
+    if (sessions == NULL || fds == NULL || ttfb == NULL)
+        return EXIT_FAILURE;
+    started = done = ttfb_count = 0;
+    seconds = now();
+    while (done < nspawns)
+    {
+        for (i = 0; i < nsessions; ++i)
+        {
+            if (sessions[i].vt100 == NULL && started < nspawns)
+            {
+                started += 1;
+                if (start(&sessions[i], use_fork, argv) == -1)
+                    done += 1;
+            }
+            fds[i].fd = sessions[i].vt100 ? sessions[i].vt100->master : -1;
+            fds[i].events = POLLIN;
+        }
+        if (poll(fds, nsessions, 1000) <= 0)
+            continue ;
+        for (i = 0; i < nsessions; ++i)
+        {
+            if (fds[i].revents == 0 || sessions[i].vt100 == NULL)
+                continue ;
+            if (vt100_headless_pump(sessions[i].vt100) > 0
+                && sessions[i].start != 0)
+            {
+                ttfb[ttfb_count++] = now() - sessions[i].start;
+                sessions[i].start = 0;
+            }
+            if (sessions[i].vt100->master_closed)
+            {
+                vt100_headless_reap(sessions[i].vt100, 1);
+                delete_vt100_headless(sessions[i].vt100);
+                sessions[i].vt100 = NULL;
+                done += 1;
+            }
+        }
+    }
+    seconds = now() - seconds;
+    printf("%lu sessions, %lu at once, %.3fs, %.0f sessions/s\n",
+           nspawns, nsessions, seconds, nspawns / seconds);
+    if (ttfb_count == 0)
+        return EXIT_FAILURE;
+    qsort(ttfb, ttfb_count, sizeof(*ttfb), compare_doubles);
+    i = ttfb_count;
+    printf("time to first byte us: p50 %.1f p90 %.1f p99 %.1f max %.1f\n",
+           ttfb[i / 2] * 1e6, ttfb[i * 9 / 10] * 1e6,
+           ttfb[i * 99 / 100] * 1e6, ttfb[i - 1] * 1e6);
+    return EXIT_SUCCESS;
+usage:
+    fprintf(stderr, "Usage: %s [-n SPAWNS] [-c CONCURRENT] [-f]"
+            " [COMMAND [ARGS]]\n", av[0]);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "vt100_capture.h"
+
+static int write_all(int fd, const char *buffer, size_t len)
+{
+    ssize_t written;
+
+    while (len > 0)
+    {
+        written = write(fd, buffer, len);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+                continue ;
+            return -1;
+        }
+        buffer += written;
+        len -= written;
+    }
+    return 0;
+}
+
+static void close_pipe(int fds[2])
+{
+    if (fds[0] != -1)
+        close(fds[0]);
+    if (fds[1] != -1)
+        close(fds[1]);
+    fds[0] = fds[1] = -1;
+}
+
+/*
+** Stops splicing for good, archiving through the buffer from now on.
+*/
+static int fall_back(struct vt100_capture *this)
+{
+    close_pipe(this->pipe);
+    close_pipe(this->copy);
+    if (this->buffer == NULL)
+        this->buffer = malloc(VT100_CAPTURE_BUFFER);
+    return this->buffer == NULL ? -1 : 0;
+}
+
+/*
+** Archives bytes that went through user space anyway: to the buffer,
+** or straight to the archive if they don't fit or there is no buffer.
+*/
+static void archive(struct vt100_capture *this, const char *data, size_t len)
+{
+    this->bytes += len;
+    if (this->buffer != NULL && this->used + len > VT100_CAPTURE_BUFFER)
+        vt100_capture_flush(this);
+    if (this->buffer != NULL && this->used + len <= VT100_CAPTURE_BUFFER)
+    {
+        memcpy(this->buffer + this->used, data, len);
+        this->used += len;
+    }
+    else if (write_all(this->fd, data, len) == -1)
+        this->error = errno;
+}
+
+/*
+** Moves len teed bytes from the copy pipe to the archive. Returns how
+** many made it; what did not is thrown away, for the caller to archive
+** from its own copy, and if the archive refuses splices, the capture
+** falls back to buffering.
+*/
+static size_t move_copy(struct vt100_capture *this, size_t len)
+{
+    char scratch[4096];
+    ssize_t moved;
+    size_t left;
+    size_t done;
+    int refused;
+
+    done = 0;
+    refused = 0;
+    while (done < len)
+    {
+        moved = splice(this->copy[0], NULL, this->fd, NULL, len - done,
+                       SPLICE_F_MOVE);
+        if (moved == -1 && errno == EINTR)
+            continue ;
+        if (moved == -1 && errno == EINVAL)
+            refused = 1;
+        else if (moved == -1)
+            this->error = errno;
+        if (moved <= 0)
+            break ;
+        done += moved;
+    }
+    for (left = len - done; left > 0; left -= moved)
+    {
+        moved = read(this->copy[0], scratch,
+                     left < sizeof(scratch) ? left : sizeof(scratch));
+        if (moved <= 0)
+        {
+            refused = 1;
+            break ;
+        }
+    }
+    if (refused)
+        fall_back(this);
+    return done;
+}
+
+/*
+** Archives to fd, splicing unless zero_copy is 0 or fd is opened with
+** O_APPEND. Returns NULL if resources are short.
+*/
+struct vt100_capture *vt100_capture_open(int fd, int zero_copy)
+{
+    struct vt100_capture *this;
+    int flags;
+
+    this = malloc(sizeof(*this));
+    if (this == NULL)
+        return NULL;
+    memset(this, 0, sizeof(*this));
+    this->fd = fd;
+    this->pipe[0] = this->pipe[1] = -1;
+    this->copy[0] = this->copy[1] = -1;
+    flags = fcntl(fd, F_GETFL);
+    if (!zero_copy || flags == -1 || (flags & O_APPEND)
+        || pipe2(this->pipe, O_CLOEXEC) == -1
+        || pipe2(this->copy, O_CLOEXEC) == -1)
+    {
+        if (fall_back(this) == -1)
+        {
+            free(this);
+            return NULL;
+        }
+    }
+    return this;
+}
+
+/*
+** Reads at most size bytes of output from master into buffer, like
+** read(2) with the same return values and errno, archiving them first.
+*/
+ssize_t vt100_capture_read(struct vt100_capture *this, int master,
+                           char *buffer, size_t size)
+{
+    ssize_t got;
+    ssize_t teed;
+    ssize_t n;
+    size_t done;
+    size_t len;
+
+    if (this->pipe[0] == -1)
+    {
+        got = read(master, buffer, size);
+        if (got > 0)
+            archive(this, buffer, got);
+        return got;
+    }
+    /* The pipes must never hold more than they can take */
+    if (size > VT100_CAPTURE_BUFFER)
+        size = VT100_CAPTURE_BUFFER;
+    got = splice(master, NULL, this->pipe[1], NULL, size, 0);
+    if (got == -1 && errno == EINVAL)
+    {
+        if (fall_back(this) == -1)
+            return -1;
+        return vt100_capture_read(this, master, buffer, size);
+    }
+    if (got <= 0)
+        return got;
+    teed = tee(this->pipe[0], this->copy[1], got, 0);
+    if (teed == -1)
+        teed = 0;
+    for (len = 0; len < (size_t)got; len += n)
+    {
+        n = read(this->pipe[0], buffer + len, got - len);
+        if (n == -1 && errno == EINTR)
+            n = 0;
+        else if (n <= 0)
+            return -1;
+    }
+    done = move_copy(this, teed);
+    this->spliced += done;
+    this->bytes += done;
+    if (done < (size_t)got)
+        archive(this, buffer + done, got - done);
+    return got;
+}
+
+int vt100_capture_flush(struct vt100_capture *this)
+{
+    size_t used;
+
+    if (this->used == 0)
+        return 0;
+    used = this->used;
+    this->used = 0;
+    if (write_all(this->fd, this->buffer, used) == -1)
+    {
+        this->error = errno;
+        return -1;
+    }
+    return 0;
+}
+
+void vt100_capture_close(struct vt100_capture *this)
+{
+    if (this == NULL)
+        return ;
+    vt100_capture_flush(this);
+    close_pipe(this->pipe);
+    close_pipe(this->copy);
+    free(this->buffer);
+    free(this);
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __VT100_CAPTURE_H__
+#define __VT100_CAPTURE_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+** Archive of the raw output of a session, byte for byte, to a file or
+** a pipe.
+**
+** Output is spliced from the master into a kernel pipe, teed into a
+** second one and spliced from there to the archive, before being read
+** from the first pipe for the parser: the bytes reach the archive
+** without ever being copied to user space, the parser gets them as
+** from a read of the master.
+**
+** The kernel may refuse: ttys can't be spliced from before Linux 5.14
+** or so, nor can files opened with O_APPEND be spliced to. The capture
+** then falls back, for good, to reading the master as usual and
+** appending the bytes to a buffer written when full or on close.
+*/
+
+#define VT100_CAPTURE_BUFFER (64 * 1024)
+
+struct vt100_capture
+{
+    int           fd; /* The archive, not closed by vt100_capture_close */
+    int           pipe[2]; /* Output from the master, -1 once buffered */
+    int           copy[2]; /* Teed from pipe, spliced to fd */
+    char          *buffer; /* NULL until falling back */
+    size_t        used;
+    unsigned long bytes; /* Archived */
+    unsigned long spliced; /* Of which without a copy */
+    int           error; /* errno of the last failed write, 0 if none */
+};
+
+struct vt100_capture *vt100_capture_open(int fd, int zero_copy);
+ssize_t vt100_capture_read(struct vt100_capture *this, int master,
+                           char *buffer, size_t size);
+int vt100_capture_flush(struct vt100_capture *this);
+void vt100_capture_close(struct vt100_capture *this);
+
+#endif
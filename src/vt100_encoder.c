@@ -0,0 +1,508 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "vt100_encoder.h"
+
+/* Bytes spent setting and resetting a scrolling region */
+#define SCROLL_OVERHEAD 16
+/* Unchanged cells worth a cursor motion rather than being rewritten */
+#define SKIP_RUN 5
+/* Blanks worth an EL rather than being written */
+#define ERASE_RUN 4
+
+/* Cells of the largest screen, so snapshots survive resizes */
+#define MAX_CELLS (132 * 80)
+
+#define ROW(this, cells, y) ((cells) + (y) * (this)->width)
+
+static const char blanks[132] =
+    "                                                                  "
+    "                                                                  ";
+
+struct vt100_encoder *vt100_encoder_new(struct lw_terminal_vt100 *vt100,
+                                        unsigned int depth)
+{
+    struct vt100_encoder *this;
+
+    this = calloc(1, sizeof(*this));
+    if (this == NULL)
+        return NULL;
+    this->vt100 = vt100;
+    this->depth = depth ? depth : 1;
+    this->history = calloc(this->depth, sizeof(*this->history));
+    this->frames = calloc(this->depth + 1, sizeof(*this->frames));
+    this->work = malloc(MAX_CELLS);
+    if (this->history == NULL || this->frames == NULL || this->work == NULL)
+    {
+        vt100_encoder_destroy(this);
+        return NULL;
+    }
+    return this;
+}
+
+static void drop_frames(struct vt100_encoder *this)
+{
+    unsigned int i;
+
+    for (i = 0; i < this->nframes; ++i)
+        free(this->frames[i].data);
+    this->nframes = 0;
+}
+
+void vt100_encoder_destroy(struct vt100_encoder *this)
+{
+    unsigned int i;
+
+    if (this == NULL)
+        return ;
+    if (this->frames != NULL)
+        drop_frames(this);
+    if (this->history != NULL)
+        for (i = 0; i < this->depth; ++i)
+            free(this->history[i].cells);
+    free(this->history);
+    free(this->frames);
+    free(this->work);
+    free(this->out);
+    free(this);
+}
+
+/*
+** Takes a snapshot of the screen if it was fed since the last one.
+** Returns the generation of the latest snapshot, the one viewers get
+** brought to.
+*/
+unsigned int vt100_encoder_snapshot(struct vt100_encoder *this)
+{
+    struct vt100_snapshot *snapshot;
+    unsigned int slot;
+
+    lw_terminal_vt100_flush(this->vt100);
+    if (this->count > 0
+        && this->history[this->latest].generation == this->vt100->generation)
+        return this->vt100->generation;
+    slot = this->count > 0 ? (this->latest + 1) % this->depth : 0;
+    snapshot = &this->history[slot];
+    if (snapshot->cells == NULL)
+    {
+        snapshot->cells = malloc(MAX_CELLS);
+        if (snapshot->cells == NULL)
+            return this->count > 0 ? this->history[this->latest].generation
+                                   : 0;
+    }
+    snapshot->width = lw_terminal_vt100_copy_screen(this->vt100,
+                                                    snapshot->cells);
+    snapshot->height = this->vt100->height;
+    snapshot->generation = this->vt100->generation;
+    /* x == width is the pending wrap after the last column, kept as is */
+    snapshot->x = this->vt100->x <= snapshot->width ? this->vt100->x
+                                                    : snapshot->width;
+    snapshot->y = this->vt100->y;
+    this->latest = slot;
+    if (this->count < this->depth)
+        this->count += 1;
+    drop_frames(this);
+    return snapshot->generation;
+}
+
+static void put(struct vt100_encoder *this, const char *data, size_t len)
+{
+    char *out;
+    size_t size;
+
+    if (this->used + len > this->size)
+    {
+        size = this->size ? this->size : 1024;
+        while (size < this->used + len)
+            size *= 2;
+        out = realloc(this->out, size);
+        if (out == NULL)
+        {
+            this->failed = 1;
+            return ;
+        }
+        this->out = out;
+        this->size = size;
+    }
+    memcpy(this->out + this->used, data, len);
+    this->used += len;
+}
+
+static void put_format(struct vt100_encoder *this, const char *format, ...)
+{
+    char buffer[32];
+    va_list ap;
+    int len;
+
+    va_start(ap, format);
+    len = vsprintf(buffer, format, ap);
+    va_end(ap);
+    put(this, buffer, len);
+}
+
+/*
+** Moves the viewer's cursor to x, y the cheapest way. Close enough on
+** the same row, rewriting what the cells must hold anyway is shorter
+** than any escape sequence.
+*/
+static void move(struct vt100_encoder *this, struct vt100_snapshot *target,
+                 unsigned int x, unsigned int y)
+{
+    int gap;
+
+    if (this->cursor_x == (int)x && this->cursor_y == (int)y)
+        return ;
+    if (this->cursor_x != -1 && this->cursor_y == (int)y)
+    {
+        gap = (int)x - this->cursor_x;
+        if (gap > 0 && gap <= 3)
+        {
+            put(this, ROW(target, target->cells, y) + this->cursor_x, gap);
+            memcpy(ROW(target, this->work, y) + this->cursor_x,
+                   ROW(target, target->cells, y) + this->cursor_x, gap);
+        }
+        else if (x == 0)
+            put(this, "\r", 1);
+        else if (gap > 0)
+            put_format(this, "\033[%dC", gap);
+        else
+            put_format(this, "\033[%dD", -gap);
+    }
+    else if (this->cursor_x != -1 && this->cursor_y + 1 == (int)y && x == 0)
+        put(this, "\r\n", 2);
+    else if (x == 0 && y == 0)
+        put(this, "\033[H", 3);
+    else if (x == 0)
+        put_format(this, "\033[%uH", y + 1);
+    else
+        put_format(this, "\033[%u;%uH", y + 1, x + 1);
+    this->cursor_x = x;
+    this->cursor_y = y;
+}
+
+static void write_cells(struct vt100_encoder *this,
+                        struct vt100_snapshot *target,
+                        unsigned int y, unsigned int from, unsigned int to)
+{
+    move(this, target, from, y);
+    put(this, ROW(target, target->cells, y) + from, to - from);
+    memcpy(ROW(target, this->work, y) + from,
+           ROW(target, target->cells, y) + from, to - from);
+    /* Past the last column the cursor waits for the next character */
+    this->cursor_x = to < target->width ? (int)to : -1;
+}
+
+/*
+** Writes the changed cells of [from, to) on row y, skipping the runs
+** of unchanged cells long enough to be worth a cursor motion.
+*/
+static void update_cells(struct vt100_encoder *this,
+                         struct vt100_snapshot *target,
+                         unsigned int y, unsigned int from, unsigned int to)
+{
+    const char *old;
+    const char *new;
+    unsigned int start;
+    unsigned int end;
+    unsigned int run;
+    unsigned int i;
+
+    old = ROW(target, this->work, y);
+    new = ROW(target, target->cells, y);
+    i = from;
+    while (i < to)
+    {
+        while (i < to && old[i] == new[i])
+            ++i;
+        if (i == to)
+            break ;
+        start = end = i;
+        while (i < to)
+        {
+            if (old[i] != new[i])
+            {
+                end = ++i;
+                continue ;
+            }
+            for (run = i; run < to && old[run] == new[run]; ++run)
+                ;
+            i = run;
+            if (run - end >= SKIP_RUN || run == to)
+                break ;
+        }
+        write_cells(this, target, y, start, end);
+    }
+}
+
+static void update_row(struct vt100_encoder *this,
+                       struct vt100_snapshot *target, unsigned int y)
+{
+    const char *old;
+    const char *new;
+    unsigned int first;
+    unsigned int last;
+    unsigned int end;
+
+    old = ROW(target, this->work, y);
+    new = ROW(target, target->cells, y);
+    for (first = 0; first < target->width && old[first] == new[first];
+         ++first)
+        ;
+    if (first == target->width)
+        return ;
+    for (last = target->width - 1; old[last] == new[last]; --last)
+        ;
+    for (end = target->width; end > 0 && new[end - 1] == ' '; --end)
+        ;
+    if (last >= end && last - end + 1 >= ERASE_RUN)
+    {
+        if (first < end)
+            update_cells(this, target, y, first, end);
+        move(this, target, end, y);
+        put(this, "\033[K", 3);
+        memset(ROW(target, this->work, y) + end, ' ', target->width - end);
+        return ;
+    }
+    update_cells(this, target, y, first, last + 1);
+}
+
+static unsigned int row_cost(const char *old, const char *new,
+                             unsigned int width)
+{
+    unsigned int first;
+    unsigned int last;
+
+    for (first = 0; first < width && old[first] == new[first]; ++first)
+        ;
+    if (first == width)
+        return 0;
+    for (last = width - 1; old[last] == new[last]; --last)
+        ;
+    return last - first + 1 + 8;
+}
+
+/*
+** Cost of updating rows [top, bottom] once the viewer's rows in there
+** are shifted by shift (up if positive), giving up past best.
+*/
+static unsigned int shifted_cost(struct vt100_encoder *this,
+                                 struct vt100_snapshot *target,
+                                 unsigned int top, unsigned int bottom,
+                                 int shift, unsigned int best)
+{
+    const char *old;
+    unsigned int cost;
+    unsigned int y;
+    int from;
+
+    cost = shift ? SCROLL_OVERHEAD + 2 * abs(shift) : 0;
+    for (y = top; y <= bottom && cost < best; ++y)
+    {
+        from = (int)y + shift;
+        if (from < (int)top || from > (int)bottom)
+            old = blanks;
+        else
+            old = ROW(target, this->work, from);
+        cost += row_cost(old, ROW(target, target->cells, y), target->width);
+    }
+    return cost;
+}
+
+/*
+** Scrolls rows [top, bottom] of the viewer by shift rows, up if
+** positive, within a scrolling region unless it is the whole screen.
+*/
+static void scroll(struct vt100_encoder *this, struct vt100_snapshot *target,
+                   unsigned int top, unsigned int bottom, int shift)
+{
+    unsigned int count;
+    unsigned int kept;
+    unsigned int i;
+    int whole;
+
+    whole = top == 0 && bottom == target->height - 1;
+    if (!whole)
+        put_format(this, "\033[%u;%ur", top + 1, bottom + 1);
+    count = abs(shift);
+    kept = bottom - top + 1 - count;
+    if (shift > 0)
+    {
+        put_format(this, "\033[%uH", bottom + 1);
+        for (i = 0; i < count; ++i)
+            put(this, "\n", 1);
+        memmove(ROW(target, this->work, top),
+                ROW(target, this->work, top + count), kept * target->width);
+        memset(ROW(target, this->work, top + kept), ' ',
+               count * target->width);
+        this->cursor_y = bottom;
+    }
+    else
+    {
+        put_format(this, "\033[%uH", top + 1);
+        for (i = 0; i < count; ++i)
+            put(this, "\033M", 2);
+        memmove(ROW(target, this->work, top + count),
+                ROW(target, this->work, top), kept * target->width);
+        memset(ROW(target, this->work, top), ' ', count * target->width);
+        this->cursor_y = top;
+    }
+    this->cursor_x = 0;
+    if (!whole)
+    {
+        /* Resetting the region homes the cursor */
+        put(this, "\033[r", 3);
+        this->cursor_x = this->cursor_y = 0;
+    }
+}
+
+static void find_scroll(struct vt100_encoder *this,
+                        struct vt100_snapshot *target)
+{
+    unsigned int top;
+    unsigned int bottom;
+    unsigned int cost;
+    unsigned int best;
+    int best_shift;
+    int shift;
+
+    for (top = 0; top < target->height
+             && !memcmp(ROW(target, this->work, top),
+                        ROW(target, target->cells, top), target->width);
+         ++top)
+        ;
+    if (top == target->height)
+        return ;
+    for (bottom = target->height - 1;
+         !memcmp(ROW(target, this->work, bottom),
+                 ROW(target, target->cells, bottom), target->width);
+         --bottom)
+        ;
+    best = shifted_cost(this, target, top, bottom, 0, (unsigned int)-1);
+    best_shift = 0;
+    for (shift = 1; shift <= (int)(bottom - top); ++shift)
+    {
+        cost = shifted_cost(this, target, top, bottom, shift, best);
+        if (cost < best)
+        {
+            best = cost;
+            best_shift = shift;
+        }
+        cost = shifted_cost(this, target, top, bottom, -shift, best);
+        if (cost < best)
+        {
+            best = cost;
+            best_shift = -shift;
+        }
+    }
+    if (best_shift != 0)
+        scroll(this, target, top, bottom, best_shift);
+}
+
+static int encode(struct vt100_encoder *this, struct vt100_snapshot *base,
+                  struct vt100_snapshot *target)
+{
+    unsigned int y;
+
+    this->used = 0;
+    this->failed = 0;
+    if (base == NULL)
+    {
+        put(this, "\033[r\033[H\033[2J", 10);
+        memset(this->work, ' ', target->width * target->height);
+        this->cursor_x = this->cursor_y = 0;
+    }
+    else
+    {
+        memcpy(this->work, base->cells, base->width * base->height);
+        this->cursor_x = base->x < base->width ? (int)base->x : -1;
+        this->cursor_y = base->y;
+        find_scroll(this, target);
+    }
+    for (y = 0; y < target->height; ++y)
+        update_row(this, target, y);
+    if (target->x == target->width)
+        /* Rewriting the last cell leaves the viewer waiting to wrap too */
+        write_cells(this, target, target->y, target->width - 1,
+                    target->width);
+    else
+        move(this, target, target->x, target->y);
+    return this->failed ? -1 : 0;
+}
+
+/*
+** Returns the bytes bringing a viewer from generation base to the
+** latest snapshot (taking one if there is none yet), or NULL if out of
+** memory. The frame belongs to the encoder and stays valid until the
+** next snapshot.
+*/
+const char *vt100_encoder_frame(struct vt100_encoder *this,
+                                unsigned int base, size_t *len)
+{
+    struct vt100_snapshot *target;
+    struct vt100_snapshot *from;
+    struct vt100_frame *frame;
+    unsigned int i;
+
+    if (this->count == 0)
+        vt100_encoder_snapshot(this);
+    if (this->count == 0)
+        return NULL;
+    target = &this->history[this->latest];
+    *len = 0;
+    if (base == target->generation)
+        return "";
+    from = NULL;
+    for (i = 0; i < this->count; ++i)
+        if (this->history[i].generation == base
+            && this->history[i].width == target->width
+            && this->history[i].height == target->height)
+            from = &this->history[i];
+    for (i = 0; i < this->nframes; ++i)
+    {
+        frame = &this->frames[i];
+        if (frame->full ? from == NULL : from != NULL && frame->base == base)
+        {
+            *len = frame->len;
+            return frame->data;
+        }
+    }
+    if (encode(this, from, target) == -1)
+        return NULL;
+    frame = &this->frames[this->nframes];
+    frame->data = malloc(this->used ? this->used : 1);
+    if (frame->data == NULL)
+        return NULL;
+    memcpy(frame->data, this->out, this->used);
+    frame->len = this->used;
+    frame->full = from == NULL;
+    frame->base = base;
+    this->nframes += 1;
+    *len = frame->len;
+    return frame->data;
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __VT100_ENCODER_H__
+#define __VT100_ENCODER_H__
+
+#include <stddef.h>
+#include "lw_terminal_vt100.h"
+
+/*
+** Minimal updates for remote viewers.
+**
+** The encoder keeps the last few screens of a lw_terminal_vt100,
+** tagged with the generation they were taken at. Given the generation
+** a viewer last acknowledged, vt100_encoder_frame returns the VT100
+** bytes bringing that viewer's terminal to the latest snapshot:
+**
+** - a band of rows that moved up or down is scrolled inside a
+**   scrolling region (DECSTBM, then LF or RI), instead of redrawn,
+** - only the changed cells of each row are written, with the
+**   shortest cursor motion to reach them,
+** - a row ending with blanks is cleared with EL instead of spaces.
+**
+** A viewer whose generation is no longer (or never was) in the history
+** gets a full repaint.
+**
+** Frames are cached by base generation until the next snapshot, so
+** all the viewers at the same generation share the same bytes and
+** only the first of them pays for the encoding.
+**
+** The encoder must be used from the thread feeding the emulator.
+*/
+
+struct vt100_snapshot
+{
+    unsigned int generation;
+    unsigned int width;
+    unsigned int height;
+    unsigned int x; /* width while waiting to wrap after the last column */
+    unsigned int y;
+    char         *cells; /* height rows of width cells */
+};
+
+struct vt100_frame
+{
+    int          full; /* Repaints everything, base is meaningless */
+    unsigned int base;
+    char         *data;
+    size_t       len;
+};
+
+struct vt100_encoder
+{
+    struct lw_terminal_vt100 *vt100;
+    struct vt100_snapshot    *history;
+    unsigned int             depth;
+    unsigned int             count;
+    unsigned int             latest;
+    struct vt100_frame       *frames;
+    unsigned int             nframes;
+    char                     *work; /* The viewer's screen while encoding */
+    char                     *out;
+    size_t                   used;
+    size_t                   size;
+    int                      failed;
+    int                      cursor_x; /* -1 when unknown */
+    int                      cursor_y;
+};
+
+struct vt100_encoder *vt100_encoder_new(struct lw_terminal_vt100 *vt100,
+                                        unsigned int depth);
+unsigned int vt100_encoder_snapshot(struct vt100_encoder *this);
+const char *vt100_encoder_frame(struct vt100_encoder *this,
+                                unsigned int base, size_t *len);
+void vt100_encoder_destroy(struct vt100_encoder *this);
+
+#endif
@@ -0,0 +1,473 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "vt100_ingest.h"
+#include "vt100_record.h"
+
+#define TTYREC_HEADER 12
+
+static unsigned long le32(const char *data)
+{
+    const unsigned char *bytes;
+
+    bytes = (const unsigned char *)data;
+    return (unsigned long)bytes[0] | (unsigned long)bytes[1] << 8
+        | (unsigned long)bytes[2] << 16 | (unsigned long)bytes[3] << 24;
+}
+
+/*
+** Returns the offset of the first clear screen sequence, or len.
+*/
+static size_t find_clear(const char *data, size_t len)
+{
+    const char *esc;
+    const char *end;
+    size_t rest;
+
+    end = data + len;
+    esc = data;
+    while ((esc = memchr(esc, '\033', end - esc)) != NULL)
+    {
+        rest = end - esc;
+        if (rest >= 4 && memcmp(esc, "\033[2J", 4) == 0)
+            return esc - data;
+        if (rest >= 6 && memcmp(esc, "\033[H\033[J", 6) == 0)
+            return esc - data;
+        esc += 1;
+    }
+    return len;
+}
+
+static void take_snapshot(struct vt100_ingest *this,
+                          struct lw_terminal_vt100 *vt100, int reason)
+{
+    unsigned int y;
+
+    for (y = 0; y < vt100->height; ++y)
+        if ((int)(vt100->line_generation[y] - this->snapshot_generation) > 0)
+            break ;
+    if (y == vt100->height)
+        return ;
+    this->snapshot_generation = vt100->generation;
+    this->snapshot(this, vt100, reason);
+}
+
+/*
+** Drops the pages of the mapping before offset parsed, as far as the
+** format loop got in it: frames themselves may have been decoded out
+** of the mapping, in the scratch buffer.
+*/
+static void drop_parsed(struct vt100_ingest *this, size_t parsed)
+{
+    size_t page;
+    size_t len;
+
+    if (this->map == NULL)
+        return ;
+    if (parsed > this->map_size)
+        parsed = this->map_size;
+    if (parsed - this->dropped < VT100_INGEST_DROP)
+        return ;
+    page = sysconf(_SC_PAGESIZE);
+    len = (parsed - this->dropped) / page * page;
+    madvise((void *)(this->map + this->dropped), len, MADV_DONTNEED);
+    this->dropped += len;
+}
+
+static void parse_frame(struct vt100_ingest *this,
+                        struct lw_terminal_vt100 *vt100,
+                        const char *data, size_t len)
+{
+    size_t start;
+    size_t search;
+    size_t clear;
+
+    start = search = 0;
+    if (this->snapshot != NULL && this->snapshot_on & VT100_SNAPSHOT_CLEAR)
+    {
+        while ((clear = search + find_clear(data + search, len - search)) < len)
+        {
+            lw_terminal_vt100_read_buf(vt100, data + start, clear - start);
+            take_snapshot(this, vt100, VT100_SNAPSHOT_CLEAR);
+            start = clear;
+            search = clear + 1;
+        }
+    }
+    lw_terminal_vt100_read_buf(vt100, data + start, len - start);
+}
+
+static void count_frame(struct vt100_ingest *this,
+                        struct lw_terminal_vt100 *vt100, size_t len)
+{
+    this->frames += 1;
+    this->bytes += len;
+    if (this->snapshot != NULL && this->snapshot_on & VT100_SNAPSHOT_EVERY
+        && this->every_frames > 0 && this->frames % this->every_frames == 0)
+        take_snapshot(this, vt100, VT100_SNAPSHOT_EVERY);
+}
+
+static void ingest_frame(struct vt100_ingest *this,
+                         struct lw_terminal_vt100 *vt100,
+                         const char *data, size_t len)
+{
+    parse_frame(this, vt100, data, len);
+    count_frame(this, vt100, len);
+}
+
+/*
+** A raw log is one frame, parsed VT100_INGEST_DROP bytes at a time so
+** its pages get dropped along the way. Slices end before an ESC close
+** to their end, not to cut a clear screen sequence in two.
+*/
+static void ingest_raw(struct vt100_ingest *this,
+                       struct lw_terminal_vt100 *vt100,
+                       const char *data, size_t size)
+{
+    const char *esc;
+    size_t pos;
+    size_t len;
+
+    for (pos = 0; pos < size; pos += len)
+    {
+        len = size - pos < VT100_INGEST_DROP ? size - pos : VT100_INGEST_DROP;
+        if (pos + len < size
+            && (esc = memchr(data + pos + len - 6, '\033', 6)) != NULL)
+            len = esc - (data + pos);
+        parse_frame(this, vt100, data + pos, len);
+        drop_parsed(this, pos + len);
+    }
+    count_frame(this, vt100, size);
+}
+
+static int ingest_ttyrec(struct vt100_ingest *this,
+                         struct lw_terminal_vt100 *vt100,
+                         const char *data, size_t size)
+{
+    size_t pos;
+    size_t len;
+
+    pos = 0;
+    while (size - pos >= TTYREC_HEADER)
+    {
+        len = le32(data + pos + 8);
+        pos += TTYREC_HEADER;
+        if (len > size - pos)
+            return -1;
+        ingest_frame(this, vt100, data + pos, len);
+        pos += len;
+        drop_parsed(this, pos);
+    }
+    return pos == size ? 0 : -1;
+}
+
+static int ingest_record(struct vt100_ingest *this,
+                         struct lw_terminal_vt100 *vt100,
+                         const char *data, size_t size)
+{
+    struct vt100_replay replay;
+    unsigned long delta;
+    const char *frame;
+    size_t len;
+    int ret;
+
+    if (vt100_replay_attach(&replay, data, size) == -1)
+        return -1;
+    while ((ret = vt100_replay_next(&replay, &delta, &frame, &len)) == 1)
+    {
+        ingest_frame(this, vt100, frame, len);
+        drop_parsed(this, replay.pos);
+    }
+    return ret;
+}
+
+static int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static int get_u16(const char *p, const char *end, unsigned long *value)
+{
+    int i;
+    int digit;
+
+    if (end - p < 4)
+        return -1;
+    *value = 0;
+    for (i = 0; i < 4; ++i)
+    {
+        digit = hex_digit(p[i]);
+        if (digit == -1)
+            return -1;
+        *value = *value << 4 | digit;
+    }
+    return 0;
+}
+
+static size_t put_utf8(char *out, unsigned long cp)
+{
+    if (cp < 0x80)
+    {
+        out[0] = cp;
+        return 1;
+    }
+    if (cp < 0x800)
+    {
+        out[0] = 0xC0 | cp >> 6;
+        out[1] = 0x80 | (cp & 0x3F);
+        return 2;
+    }
+    if (cp < 0x10000)
+    {
+        out[0] = 0xE0 | cp >> 12;
+        out[1] = 0x80 | (cp >> 6 & 0x3F);
+        out[2] = 0x80 | (cp & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | cp >> 18;
+    out[1] = 0x80 | (cp >> 12 & 0x3F);
+    out[2] = 0x80 | (cp >> 6 & 0x3F);
+    out[3] = 0x80 | (cp & 0x3F);
+    return 4;
+}
+
+/*
+** Decodes the JSON string starting right after its opening quote.
+** Strings without escapes are returned in place, others are decoded
+** in the scratch buffer: a decoded string is never longer than its
+** encoded form.
+*/
+static int json_string(struct vt100_ingest *this,
+                       const char *p, const char *end,
+                       const char **out, size_t *len)
+{
+    const char *q;
+    char *dst;
+    unsigned long cp;
+    unsigned long low;
+
+    for (q = p; q < end && *q != '"' && *q != '\\'; ++q)
+        ;
+    if (q == end)
+        return -1;
+    if (*q == '"')
+    {
+        *out = p;
+        *len = q - p;
+        return 0;
+    }
+    if ((size_t)(end - p) > this->scratch_size)
+    {
+        dst = realloc(this->scratch, end - p);
+        if (dst == NULL)
+            return -1;
+        this->scratch = dst;
+        this->scratch_size = end - p;
+    }
+    memcpy(this->scratch, p, q - p);
+    dst = this->scratch + (q - p);
+    while (q < end && *q != '"')
+    {
+        if (*q != '\\')
+        {
+            *dst++ = *q++;
+            continue ;
+        }
+        if (++q == end)
+            return -1;
+        switch (*q++)
+        {
+        case 'n': *dst++ = '\n'; break ;
+        case 'r': *dst++ = '\r'; break ;
+        case 't': *dst++ = '\t'; break ;
+        case 'b': *dst++ = '\b'; break ;
+        case 'f': *dst++ = '\f'; break ;
+        case 'u':
+            if (get_u16(q, end, &cp) == -1)
+                return -1;
+            q += 4;
+            if (cp >= 0xD800 && cp < 0xDC00 && end - q >= 6 && q[0] == '\\'
+                && q[1] == 'u' && get_u16(q + 2, end, &low) == 0
+                && low >= 0xDC00 && low < 0xE000)
+            {
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                q += 6;
+            }
+            dst += put_utf8(dst, cp);
+            break ;
+        default: *dst++ = q[-1]; break ;
+        }
+    }
+    if (q == end)
+        return -1;
+    *out = this->scratch;
+    *len = dst - this->scratch;
+    return 0;
+}
+
+static int ingest_asciicast(struct vt100_ingest *this,
+                            struct lw_terminal_vt100 *vt100,
+                            const char *data, size_t size)
+{
+    const char *line;
+    const char *eol;
+    const char *end;
+    const char *p;
+    const char *frame;
+    size_t len;
+
+    end = data + size;
+    line = memchr(data, '\n', size);
+    while (line != NULL && ++line < end)
+    {
+        eol = memchr(line, '\n', end - line);
+        if (eol == NULL)
+            eol = end;
+        p = memchr(line, ',', eol - line);
+        while (p != NULL && ++p < eol && *p == ' ')
+            ;
+        if (p != NULL && eol - p > 3 && p[0] == '"' && p[1] == 'o'
+            && p[2] == '"')
+        {
+            p = memchr(p + 3, '"', eol - p - 3);
+            if (p == NULL || json_string(this, p + 1, eol, &frame, &len) == -1)
+                return -1;
+            ingest_frame(this, vt100, frame, len);
+            drop_parsed(this, eol - data);
+        }
+        line = eol == end ? NULL : eol;
+    }
+    return 0;
+}
+
+enum vt100_ingest_format vt100_ingest_detect(const char *data, size_t size)
+{
+    size_t pos;
+    size_t len;
+
+    if (size >= 4 && memcmp(data, VT100_RECORD_MAGIC, 4) == 0)
+        return VT100_INGEST_RECORD;
+    for (pos = 0; pos < size && strchr(" \t\r\n", data[pos]) != NULL; ++pos)
+        ;
+    if (pos < size && data[pos] == '{')
+        return VT100_INGEST_ASCIICAST;
+    if (size >= TTYREC_HEADER && le32(data + 4) < 1000000)
+    {
+        len = le32(data + 8);
+        if (len == size - TTYREC_HEADER)
+            return VT100_INGEST_TTYREC;
+        if (len < size - TTYREC_HEADER
+            && size - TTYREC_HEADER - len >= TTYREC_HEADER
+            && le32(data + TTYREC_HEADER + len + 4) < 1000000
+            && le32(data + TTYREC_HEADER + len) >= le32(data))
+            return VT100_INGEST_TTYREC;
+    }
+    return VT100_INGEST_RAW;
+}
+
+int vt100_ingest_buf(struct vt100_ingest *this,
+                     struct lw_terminal_vt100 *vt100,
+                     const char *data, size_t size)
+{
+    enum vt100_ingest_format format;
+    int ret;
+
+    format = this->format;
+    if (format == VT100_INGEST_AUTO)
+        format = vt100_ingest_detect(data, size);
+    this->snapshot_generation = vt100->generation;
+    switch (format)
+    {
+    case VT100_INGEST_TTYREC:
+        ret = ingest_ttyrec(this, vt100, data, size);
+        break ;
+    case VT100_INGEST_ASCIICAST:
+        ret = ingest_asciicast(this, vt100, data, size);
+        break ;
+    case VT100_INGEST_RECORD:
+        ret = ingest_record(this, vt100, data, size);
+        break ;
+    default:
+        ingest_raw(this, vt100, data, size);
+        ret = 0;
+    }
+    if (this->snapshot != NULL && this->snapshot_on & VT100_SNAPSHOT_END)
+        take_snapshot(this, vt100, VT100_SNAPSHOT_END);
+    return ret;
+}
+
+int vt100_ingest_file(struct vt100_ingest *this,
+                      struct lw_terminal_vt100 *vt100,
+                      const char *path)
+{
+    struct stat st;
+    void *map;
+    int fd;
+    int ret;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    if (fstat(fd, &st) == -1)
+        goto close_fd;
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return vt100_ingest_buf(this, vt100, "", 0);
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        goto close_fd;
+    close(fd);
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    this->map = map;
+    this->map_size = st.st_size;
+    this->dropped = 0;
+    ret = vt100_ingest_buf(this, vt100, map, st.st_size);
+    this->map = NULL;
+    munmap(map, st.st_size);
+    return ret;
+close_fd:
+    close(fd);
+    return -1;
+}
+
+void vt100_ingest_release(struct vt100_ingest *this)
+{
+    free(this->scratch);
+    this->scratch = NULL;
+    this->scratch_size = 0;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __VT100_INGEST_H__
+#define __VT100_INGEST_H__
+
+#include <stddef.h>
+#include "lw_terminal_vt100.h"
+
+/*
+** Offline ingestion of terminal logs.
+**
+** The log is mmap'ed and its frames are handed to the parser straight
+** from the mapping, only asciicast strings containing escapes are
+** decoded in a scratch buffer. Pages already parsed are dropped every
+** VT100_INGEST_DROP bytes so huge logs do not fill the page cache of
+** the process.
+**
+** Supported formats:
+** - raw: output as captured by script(1) or a redirection, one frame,
+** - ttyrec: 12 bytes headers (sec, usec, len as little endian 32 bits)
+**   each followed by a frame,
+** - asciicast v2: a JSON header line then one [time, "o", "data"] line
+**   per frame, other event types are skipped,
+** - vt100_record logs (see vt100_record.h).
+**
+** snapshot is called with the emulator:
+** - every every_frames frames if non zero,
+** - right before a clear screen (ESC [ 2 J, or ESC [ H ESC [ J) if
+**   VT100_SNAPSHOT_CLEAR is set, with the screen about to be erased,
+** - once at the end if VT100_SNAPSHOT_END is set.
+** Snapshots are skipped when nothing changed since the previous one.
+*/
+
+#define VT100_INGEST_DROP (64 * 1024 * 1024)
+
+#define VT100_SNAPSHOT_EVERY 1
+#define VT100_SNAPSHOT_CLEAR 2
+#define VT100_SNAPSHOT_END   4
+
+enum vt100_ingest_format
+{
+    VT100_INGEST_AUTO,
+    VT100_INGEST_RAW,
+    VT100_INGEST_TTYREC,
+    VT100_INGEST_ASCIICAST,
+    VT100_INGEST_RECORD
+};
+
+struct vt100_ingest
+{
+    enum vt100_ingest_format format;
+    int                      snapshot_on;
+    unsigned long            every_frames;
+    void                     (*snapshot)(struct vt100_ingest *this,
+                                         struct lw_terminal_vt100 *vt100,
+                                         int reason);
+    void                     *user_data;
+    /* Updated while ingesting */
+    unsigned long            frames;
+    unsigned long            bytes;
+    unsigned int             snapshot_generation;
+    char                     *scratch;
+    size_t                   scratch_size;
+    const char               *map; /* Set by vt100_ingest_file */
+    size_t                   map_size;
+    size_t                   dropped;
+};
+
+enum vt100_ingest_format vt100_ingest_detect(const char *data, size_t size);
+int vt100_ingest_buf(struct vt100_ingest *this,
+                     struct lw_terminal_vt100 *vt100,
+                     const char *data, size_t size);
+int vt100_ingest_file(struct vt100_ingest *this,
+                      struct lw_terminal_vt100 *vt100,
+                      const char *path);
+void vt100_ingest_release(struct vt100_ingest *this);
+
+#endif
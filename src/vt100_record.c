@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "vt100_record.h"
+
+#define HEADER_SIZE (sizeof(VT100_RECORD_MAGIC) - 1 + 1)
+
+static size_t put_varint(char *buffer, unsigned long value)
+{
+    size_t i;
+
+    i = 0;
+    while (value >= 0x80)
+    {
+        buffer[i++] = (char)(value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    buffer[i++] = (char)value;
+    return i;
+}
+
+static int get_varint(struct vt100_replay *this, unsigned long *value)
+{
+    unsigned int shift;
+    unsigned char byte;
+
+    *value = 0;
+    for (shift = 0; shift < sizeof(*value) * 8; shift += 7)
+    {
+        if (this->pos >= this->size)
+            return -1;
+        byte = this->map[this->pos++];
+        *value |= (unsigned long)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return 0;
+    }
+    return -1;
+}
+
+/*
+** Latches the first error: appending after a torn record would leave
+** garbage for replay to decode.
+*/
+static int write_all(struct vt100_record *this, struct iovec *iov, int iovcnt)
+{
+    ssize_t written;
+
+    while (iovcnt > 0)
+    {
+        written = writev(this->fd, iov, iovcnt);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+                continue ;
+            this->error = errno;
+            return -1;
+        }
+        while (iovcnt > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov += 1;
+            iovcnt -= 1;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+struct vt100_record *vt100_record_open(const char *path)
+{
+    struct vt100_record *this;
+
+    this = calloc(1, sizeof(*this));
+    if (this == NULL)
+        return NULL;
+    this->buffer = malloc(VT100_RECORD_BUFFER);
+    if (this->buffer == NULL)
+        goto free_this;
+    this->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (this->fd == -1)
+        goto free_buffer;
+    memcpy(this->buffer, VT100_RECORD_MAGIC, HEADER_SIZE - 1);
+    this->buffer[HEADER_SIZE - 1] = VT100_RECORD_VERSION;
+    this->used = HEADER_SIZE;
+    return this;
+free_buffer:
+    free(this->buffer);
+free_this:
+    free(this);
+    return NULL;
+}
+
+/*
+** Chunks bigger than what is left in the buffer are written along with
+** the buffer in the same writev, never copied.
+*/
+int vt100_record_chunk(struct vt100_record *this, unsigned long now_usec,
+                       const char *data, size_t len)
+{
+    char header[2 * (sizeof(unsigned long) * 8 / 7 + 1)];
+    size_t header_size;
+    struct iovec iov[3];
+
+    if (this->error != 0)
+        return -1;
+    header_size = put_varint(header,
+                             this->started ? now_usec - this->last_usec : 0);
+    header_size += put_varint(header + header_size, len);
+    this->started = 1;
+    this->last_usec = now_usec;
+    if (this->used + header_size + len <= VT100_RECORD_BUFFER)
+    {
+        memcpy(this->buffer + this->used, header, header_size);
+        memcpy(this->buffer + this->used + header_size, data, len);
+        this->used += header_size + len;
+        return 0;
+    }
+    iov[0].iov_base = this->buffer;
+    iov[0].iov_len = this->used;
+    iov[1].iov_base = header;
+    iov[1].iov_len = header_size;
+    iov[2].iov_base = (void *)data;
+    iov[2].iov_len = len;
+    this->used = 0;
+    return write_all(this, iov, 3);
+}
+
+int vt100_record_flush(struct vt100_record *this)
+{
+    struct iovec iov;
+
+    if (this->error != 0)
+        return -1;
+    if (this->used == 0)
+        return 0;
+    iov.iov_base = this->buffer;
+    iov.iov_len = this->used;
+    this->used = 0;
+    return write_all(this, &iov, 1);
+}
+
+void vt100_record_close(struct vt100_record *this)
+{
+    if (this == NULL)
+        return ;
+    vt100_record_flush(this);
+    close(this->fd);
+    free(this->buffer);
+    free(this);
+}
+
+/*
+** Replays a log already in memory, this does not take ownership of
+** data, so vt100_replay_close must not be called on this.
+*/
+int vt100_replay_attach(struct vt100_replay *this,
+                        const char *data, size_t size)
+{
+    if (size < HEADER_SIZE
+        || memcmp(data, VT100_RECORD_MAGIC, HEADER_SIZE - 1) != 0
+        || data[HEADER_SIZE - 1] != VT100_RECORD_VERSION)
+        return -1;
+    this->map = data;
+    this->size = size;
+    this->pos = HEADER_SIZE;
+    this->clock_usec = 0;
+    return 0;
+}
+
+struct vt100_replay *vt100_replay_open(const char *path)
+{
+    struct vt100_replay *this;
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+    this = calloc(1, sizeof(*this));
+    if (this == NULL)
+        goto close_fd;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < HEADER_SIZE)
+        goto free_this;
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        goto free_this;
+    if (vt100_replay_attach(this, map, st.st_size) == -1)
+        goto unmap;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    close(fd);
+    return this;
+unmap:
+    munmap(map, st.st_size);
+free_this:
+    free(this);
+close_fd:
+    close(fd);
+    return NULL;
+}
+
+/*
+** Points data to the next chunk, straight into the mapping.
+** Returns 1 on success, 0 at the end of the log, -1 if it is truncated
+** or corrupted.
+*/
+int vt100_replay_next(struct vt100_replay *this, unsigned long *delta_usec,
+                      const char **data, size_t *len)
+{
+    unsigned long length;
+
+    if (this->pos == this->size)
+        return 0;
+    if (get_varint(this, delta_usec) == -1 || get_varint(this, &length) == -1)
+        return -1;
+    if (length > this->size - this->pos)
+        return -1;
+    *data = this->map + this->pos;
+    *len = length;
+    this->pos += length;
+    this->clock_usec += *delta_usec;
+    return 1;
+}
+
+void vt100_replay_rewind(struct vt100_replay *this)
+{
+    this->pos = HEADER_SIZE;
+    this->clock_usec = 0;
+}
+
+void vt100_replay_close(struct vt100_replay *this)
+{
+    if (this == NULL)
+        return ;
+    munmap((void *)this->map, this->size);
+    free(this);
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __VT100_RECORD_H__
+#define __VT100_RECORD_H__
+
+#include <stddef.h>
+
+/*
+** Timestamped capture of what a session read from its master.
+**
+** File format
+** ===========
+**
+** The file starts with the 4 bytes "VT1R" followed by a version byte
+** (VT100_RECORD_VERSION). Then, for each chunk read from the master:
+**
+**     varint  microseconds elapsed since the previous chunk
+**     varint  length of the chunk
+**     bytes   the chunk itself
+**
+** varints are unsigned LEB128: 7 bits per byte, least significant
+** group first, high bit set on every byte but the last.
+**
+** Records are appended to an in-memory buffer and only hit the file,
+** with a single writev, when the buffer is full or on flush/close.
+** After a failed write, the file may end with a torn record: error is
+** set and nothing more is written, so what is there can be replayed.
+*/
+
+#define VT100_RECORD_MAGIC   "VT1R"
+#define VT100_RECORD_VERSION 1
+#define VT100_RECORD_BUFFER  (64 * 1024)
+
+struct vt100_record
+{
+    int           fd;
+    char          *buffer;
+    size_t        used;
+    int           started;
+    unsigned long last_usec;
+    int           error; /* errno of the first failed write, or 0 */
+};
+
+struct vt100_replay
+{
+    const char    *map;
+    size_t        size;
+    size_t        pos;
+    unsigned long clock_usec; /* Virtual time of the last chunk returned */
+};
+
+struct vt100_record *vt100_record_open(const char *path);
+int vt100_record_chunk(struct vt100_record *this, unsigned long now_usec,
+                       const char *data, size_t len);
+int vt100_record_flush(struct vt100_record *this);
+void vt100_record_close(struct vt100_record *this);
+
+struct vt100_replay *vt100_replay_open(const char *path);
+int vt100_replay_attach(struct vt100_replay *this,
+                        const char *data, size_t size);
+int vt100_replay_next(struct vt100_replay *this, unsigned long *delta_usec,
+                      const char **data, size_t *len);
+void vt100_replay_rewind(struct vt100_replay *this);
+void vt100_replay_close(struct vt100_replay *this);
+
+#endif
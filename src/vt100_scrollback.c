@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include "vt100_scrollback.h"
+
+/* Mappings start this big and double when the files outgrow them */
+#define MAP_MIN (1024 * 1024)
+
+static int write_all(int fd, const char *buffer, size_t len, off_t offset)
+{
+    ssize_t written;
+
+    while (len > 0)
+    {
+        written = pwrite(fd, buffer, len, offset);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+                continue ;
+            return -1;
+        }
+        buffer += written;
+        len -= written;
+        offset += written;
+    }
+    return 0;
+}
+
+/*
+** Makes sure the first needed bytes of the file are mapped. Mappings
+** are shared, so they see what gets appended without being redone
+** until the file outgrows them.
+*/
+static int map_file(int fd, const char **map, size_t *mapped, size_t needed)
+{
+    size_t size;
+    void *new;
+
+    if (*map != NULL && needed <= *mapped)
+        return 0;
+    for (size = *mapped ? *mapped * 2 : MAP_MIN; size < needed; size *= 2)
+        ;
+    new = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (new == MAP_FAILED)
+        return -1;
+    if (*map != NULL)
+        munmap((void *)*map, *mapped);
+    *map = new;
+    *mapped = size;
+    return 0;
+}
+
+static int open_file(const char *path, const char *suffix)
+{
+    char *name;
+    int fd;
+
+    name = malloc(strlen(path) + strlen(suffix) + 1);
+    if (name == NULL)
+        return -1;
+    strcpy(name, path);
+    strcat(name, suffix);
+    fd = open(name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    free(name);
+    return fd;
+}
+
+struct vt100_scrollback *vt100_scrollback_open(const char *path)
+{
+    struct vt100_scrollback *this;
+
+    this = calloc(1, sizeof(*this));
+    if (this == NULL)
+        return NULL;
+    this->buffer = malloc(VT100_SCROLLBACK_BUFFER);
+    if (this->buffer == NULL)
+        goto free_this;
+    this->ends = malloc(VT100_SCROLLBACK_BATCH * sizeof(*this->ends));
+    if (this->ends == NULL)
+        goto free_buffer;
+    this->data_fd = open_file(path, "");
+    if (this->data_fd == -1)
+        goto free_ends;
+    this->index_fd = open_file(path, ".idx");
+    if (this->index_fd == -1)
+        goto close_data;
+    return this;
+close_data:
+    close(this->data_fd);
+free_ends:
+    free(this->ends);
+free_buffer:
+    free(this->buffer);
+free_this:
+    free(this);
+    return NULL;
+}
+
+/*
+** The lines go before their ends so the index never points past the
+** data. Both are written where they belong rather than at the end of
+** the files: if a write fails, the lines of the buffers are lost, and
+** whatever made it to the files gets overwritten by the next lines.
+*/
+int vt100_scrollback_flush(struct vt100_scrollback *this)
+{
+    int ret;
+
+    if (this->batch == 0)
+        return 0;
+    ret = 0;
+    if (write_all(this->data_fd, this->buffer, this->used,
+                  this->size - this->used) == -1
+        || write_all(this->index_fd, (const char *)this->ends,
+                     this->batch * sizeof(*this->ends),
+                     this->written * sizeof(*this->ends)) == -1)
+    {
+        this->size -= this->used;
+        this->lines = this->written;
+        ret = -1;
+    }
+    else
+        this->written = this->lines;
+    this->used = 0;
+    this->batch = 0;
+    return ret;
+}
+
+int vt100_scrollback_append(struct vt100_scrollback *this,
+                            const char *line, unsigned int width)
+{
+    while (width > 0 && line[width - 1] == ' ')
+        width -= 1;
+    if ((this->used + width > VT100_SCROLLBACK_BUFFER
+         || this->batch == VT100_SCROLLBACK_BATCH)
+        && vt100_scrollback_flush(this) == -1)
+        return -1;
+    memcpy(this->buffer + this->used, line, width);
+    this->used += width;
+    this->size += width;
+    this->ends[this->batch++] = this->size;
+    this->lines += 1;
+    return 0;
+}
+
+/*
+** Points to line n, the oldest being 0, straight into the mapping, and
+** sets len to its length. The pointer stays valid until the next call.
+** Returns NULL if there is no such line or on error.
+*/
+const char *vt100_scrollback_line(struct vt100_scrollback *this,
+                                  unsigned long n, size_t *len)
+{
+    const unsigned long *ends;
+    unsigned long start;
+
+    if (n >= this->lines)
+        return NULL;
+    if (n >= this->written && vt100_scrollback_flush(this) == -1)
+        return NULL;
+    if (map_file(this->index_fd, &this->index_map, &this->index_mapped,
+                 (n + 1) * sizeof(*ends)) == -1)
+        return NULL;
+    ends = (const unsigned long *)this->index_map;
+    start = n > 0 ? ends[n - 1] : 0;
+    if (map_file(this->data_fd, &this->data_map, &this->data_mapped,
+                 ends[n]) == -1)
+        return NULL;
+    *len = ends[n] - start;
+    return this->data_map + start;
+}
+
+void vt100_scrollback_close(struct vt100_scrollback *this)
+{
+    if (this == NULL)
+        return ;
+    vt100_scrollback_flush(this);
+    if (this->data_map != NULL)
+        munmap((void *)this->data_map, this->data_mapped);
+    if (this->index_map != NULL)
+        munmap((void *)this->index_map, this->index_mapped);
+    close(this->index_fd);
+    close(this->data_fd);
+    free(this->ends);
+    free(this->buffer);
+    free(this);
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __VT100_SCROLLBACK_H__
+#define __VT100_SCROLLBACK_H__
+
+#include <stddef.h>
+
+/*
+** Lines scrolled off the top of the screen, kept on disk so a session
+** can keep its whole history without it staying in memory.
+**
+** File format
+** ===========
+**
+** Two append-only files. The one at path holds the lines one after the
+** other, each without its trailing blanks and without any separator.
+** The one at path with ".idx" appended holds, for each line, the
+** offset in the first file where it ends, as a native unsigned long.
+** Line n spans from the end of line n - 1 (0 for the first line) to
+** its own end, so finding it takes two reads of the index, whatever
+** the length of the history.
+**
+** Lines are appended to in-memory buffers and only hit the files, with
+** a single write each, when a buffer is full or on flush/close. They
+** are read back through read-only mappings of the files, so only the
+** pages of the lines looked at are brought in.
+**
+** Not thread-safe: lines are to be read by the thread feeding the
+** emulator.
+*/
+
+#define VT100_SCROLLBACK_BUFFER (64 * 1024)
+#define VT100_SCROLLBACK_BATCH  (VT100_SCROLLBACK_BUFFER / 32)
+
+struct vt100_scrollback
+{
+    int           data_fd;
+    int           index_fd;
+    char          *buffer; /* Lines not written yet */
+    size_t        used;
+    unsigned long *ends; /* Their ends, VT100_SCROLLBACK_BATCH at most */
+    size_t        batch;
+    unsigned long lines; /* Written or not */
+    unsigned long written; /* Lines in the files */
+    unsigned long size; /* Bytes of all the lines */
+    const char    *data_map;
+    size_t        data_mapped;
+    const char    *index_map;
+    size_t        index_mapped;
+};
+
+struct vt100_scrollback *vt100_scrollback_open(const char *path);
+int vt100_scrollback_append(struct vt100_scrollback *this,
+                            const char *line, unsigned int width);
+const char *vt100_scrollback_line(struct vt100_scrollback *this,
+                                  unsigned long n, size_t *len);
+int vt100_scrollback_flush(struct vt100_scrollback *this);
+void vt100_scrollback_close(struct vt100_scrollback *this);
+
+#endif
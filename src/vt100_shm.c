@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "lw_terminal_vt100.h"
+#include "vt100_shm.h"
+
+/*
+** Creates (or takes over) the segment name, like "/session-42", and
+** has vt100 keep it up to date. Returns 0, or -1 with errno set.
+*/
+int vt100_shm_publish(struct lw_terminal_vt100 *vt100, const char *name)
+{
+    struct vt100_shm *shm;
+    void *map;
+    int fd;
+
+    shm = calloc(1, sizeof(*shm));
+    if (shm == NULL)
+        return -1;
+    shm->name = malloc(strlen(name) + 1);
+    if (shm->name == NULL)
+        goto free_shm;
+    strcpy(shm->name, name);
+    shm->size = VT100_SHM_HEADER + VT100_SHM_STRIDE * vt100->height;
+    fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+    if (fd == -1)
+        goto free_name;
+    if (ftruncate(fd, shm->size) == -1)
+        goto close_fd;
+    map = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        goto close_fd;
+    close(fd);
+    shm->screen = map;
+    memset(shm->screen, 0, shm->size);
+    shm->screen->magic = VT100_SHM_MAGIC;
+    shm->screen->version = VT100_SHM_VERSION;
+    shm->fresh = 1;
+    vt100_shm_unpublish(vt100);
+    pthread_mutex_lock(&vt100->mutex);
+    vt100->shm = shm;
+    pthread_mutex_unlock(&vt100->mutex);
+    lw_terminal_vt100_publish(vt100);
+    return 0;
+close_fd:
+    close(fd);
+    shm_unlink(name);
+free_name:
+    free(shm->name);
+free_shm:
+    free(shm);
+    return -1;
+}
+
+/*
+** Stops publishing and removes the segment. Readers still attached
+** keep the last screen.
+*/
+void vt100_shm_unpublish(struct lw_terminal_vt100 *vt100)
+{
+    struct vt100_shm *shm;
+
+    pthread_mutex_lock(&vt100->mutex);
+    shm = vt100->shm;
+    vt100->shm = NULL;
+    pthread_mutex_unlock(&vt100->mutex);
+    if (shm == NULL)
+        return ;
+    munmap(shm->screen, shm->size);
+    shm_unlink(shm->name);
+    free(shm->name);
+    free(shm);
+}
+
+/*
+** Maps the segment name read-only, storing the size of the mapping in
+** *size for vt100_shm_detach. Returns NULL if it does not exist or is
+** not a screen this version understands.
+*/
+const struct vt100_shm_screen *vt100_shm_attach(const char *name,
+                                                size_t *size)
+{
+    struct vt100_shm_screen *screen;
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1)
+        return NULL;
+    map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= VT100_SHM_HEADER)
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+    screen = map;
+    if (screen->magic != VT100_SHM_MAGIC
+        || screen->version != VT100_SHM_VERSION
+        || (size_t)st.st_size
+           < VT100_SHM_HEADER + VT100_SHM_STRIDE * (size_t)screen->height)
+    {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    *size = st.st_size;
+    return screen;
+}
+
+unsigned int vt100_shm_read_begin(const struct vt100_shm_screen *screen)
+{
+    unsigned int sequence;
+
+    while ((sequence = __atomic_load_n(&screen->sequence,
+                                       __ATOMIC_ACQUIRE)) & 1)
+        ;
+    return sequence;
+}
+
+/*
+** Tells whether what was read since vt100_shm_read_begin may be torn
+** by an update, and has to be read again.
+*/
+int vt100_shm_read_retry(const struct vt100_shm_screen *screen,
+                         unsigned int sequence)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&screen->sequence, __ATOMIC_RELAXED) != sequence;
+}
+
+/*
+** Unmaps a screen, size being what vt100_shm_attach stored: the
+** height it holds may have changed since.
+*/
+void vt100_shm_detach(const struct vt100_shm_screen *screen, size_t size)
+{
+    munmap((void *)screen, size);
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __VT100_SHM_H__
+#define __VT100_SHM_H__
+
+#include <stddef.h>
+
+/*
+** Publication of a screen in POSIX shared memory.
+**
+** vt100_shm_publish makes a lw_terminal_vt100 copy its visible grid to
+** a named segment (see shm_open(3)) after each buffer it parses, so
+** other processes on the host can read it without running their own
+** emulator nor asking anyone.
+**
+** Segment layout
+** ==============
+**
+** All fields are native-endian 32-bit unsigned integers:
+**
+**     offset  field
+**          0  magic, VT100_SHM_MAGIC
+**          4  version, VT100_SHM_VERSION
+**          8  sequence, see below
+**         12  generation of the emulator at the last update
+**         16  width, in columns (80 or 132)
+**         20  height, in rows
+**         24  x, cursor column, width right after writing the last one
+**         28  y, cursor row
+**         32  modes, the MASK_* bits of lw_terminal_vt100.h
+**         36  margin_top
+**         40  margin_bottom
+**         44  reserved, 0
+**         64  height rows of VT100_SHM_STRIDE bytes, of which only the
+**             first width are meaningful
+**
+** Consistency
+** ===========
+**
+** The publisher bumps sequence to an odd value, updates the segment,
+** then bumps it again to an even value. It never waits for anybody. A
+** reader reads sequence (waiting for it to be even), reads whatever it
+** needs in place, then checks sequence did not change, retrying
+** otherwise:
+**
+**     do
+**     {
+**         seq = vt100_shm_read_begin(screen);
+**         ... read screen fields and VT100_SHM_ROW(screen, y) ...
+**     } while (vt100_shm_read_retry(screen, seq));
+*/
+
+#define VT100_SHM_MAGIC   0x53315456 /* "VT1S" in little endian */
+#define VT100_SHM_VERSION 1
+#define VT100_SHM_HEADER  64
+#define VT100_SHM_STRIDE  132
+
+#define VT100_SHM_ROW(screen, y)                        \
+    ((const char *)(screen) + VT100_SHM_HEADER + (y) * VT100_SHM_STRIDE)
+
+struct vt100_shm_screen
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned int sequence;
+    unsigned int generation;
+    unsigned int width;
+    unsigned int height;
+    unsigned int x;
+    unsigned int y;
+    unsigned int modes;
+    unsigned int margin_top;
+    unsigned int margin_bottom;
+    unsigned int reserved[5];
+};
+
+struct vt100_shm
+{
+    char                    *name;
+    struct vt100_shm_screen *screen;
+    size_t                  size;
+    unsigned int            published; /* Generation last copied */
+    int                     fresh; /* Nothing copied yet */
+};
+
+struct lw_terminal_vt100;
+
+int vt100_shm_publish(struct lw_terminal_vt100 *vt100, const char *name);
+void vt100_shm_unpublish(struct lw_terminal_vt100 *vt100);
+
+const struct vt100_shm_screen *vt100_shm_attach(const char *name,
+                                                size_t *size);
+unsigned int vt100_shm_read_begin(const struct vt100_shm_screen *screen);
+int vt100_shm_read_retry(const struct vt100_shm_screen *screen,
+                         unsigned int sequence);
+void vt100_shm_detach(const struct vt100_shm_screen *screen, size_t size);
+
+#endif
@@ -0,0 +1,779 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "hl_vt100.h"
+#include "vt100d.h"
+
+/*
+** Serves headless sessions on a Unix socket, see vt100d.h.
+**
+** Usage: vt100d [-m METRICS_SOCKET] [-i IDLE_SECONDS] [-l LAZY_KB] SOCKET
+**
+** A single thread multiplexes the listening socket, the clients, and
+** the masters and pidfds of every session with poll(2). Screens are
+** sent with writev straight from the rows of the emulators; only what
+** a socket does not take right away is copied, to a buffer of the
+** client flushed once the socket is writable again.
+**
+** With -i, the emulators of sessions quiet for IDLE_SECONDS hibernate,
+** waking up on their next output or screen request.
+**
+** With -l, the emulators keep up to LAZY_KB of output unparsed until
+** a client asks for the screen, see lw_terminal_vt100_lazy.
+*/
+
+/* Updates to a client are held back while it has this much unsent */
+#define OUT_LIMIT (256 * 1024)
+
+struct session
+{
+    struct vt100_headless *vt100;
+    unsigned int          id;
+    struct session        *next;
+};
+
+struct subscription
+{
+    struct session      *session;
+    unsigned int        generation;
+    struct subscription *next;
+};
+
+struct client
+{
+    int                 fd;
+    char                *in;
+    size_t              in_used;
+    size_t              in_size;
+    char                *out;
+    size_t              out_used;
+    size_t              out_size;
+    struct subscription *subscriptions;
+    int                 dead;
+    struct client       *next;
+};
+
+struct watch
+{
+    struct client  *client;
+    struct session *session;
+};
+
+static struct session *sessions;
+static struct client  *clients;
+static unsigned int   next_session = 1;
+static unsigned long  hibernate_after_usec;
+static size_t         lazy_budget;
+static unsigned short row_numbers[80];
+
+static int reserve(char **buffer, size_t *size, size_t needed)
+{
+    char *grown;
+    size_t new_size;
+
+    if (needed <= *size)
+        return 0;
+    new_size = *size ? *size : 4096;
+    while (new_size < needed)
+        new_size *= 2;
+    grown = realloc(*buffer, new_size);
+    if (grown == NULL)
+        return -1;
+    *buffer = grown;
+    *size = new_size;
+    return 0;
+}
+
+/*
+** Sends iov to the client without blocking, queueing whatever the
+** socket does not take.
+*/
+static void send_iov(struct client *client, struct iovec *iov, int iovcnt)
+{
+    struct msghdr msg;
+    ssize_t sent;
+    size_t left;
+    int i;
+
+    sent = 0;
+    if (client->out_used == 0)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        sent = sendmsg(client->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent == -1)
+        {
+            if (errno != EAGAIN && errno != EINTR)
+            {
+                client->dead = 1;
+                return ;
+            }
+            sent = 0;
+        }
+    }
+    for (i = 0; i < iovcnt; ++i)
+    {
+        if ((size_t)sent >= iov[i].iov_len)
+        {
+            sent -= iov[i].iov_len;
+            continue ;
+        }
+        left = iov[i].iov_len - sent;
+        if (reserve(&client->out, &client->out_size,
+                    client->out_used + left) == -1)
+        {
+            client->dead = 1;
+            return ;
+        }
+        memcpy(client->out + client->out_used,
+               (char *)iov[i].iov_base + sent, left);
+        client->out_used += left;
+        sent = 0;
+    }
+}
+
+static void reply(struct client *client, struct vt100d_header *request,
+                  int status, const void *payload, size_t len)
+{
+    struct vt100d_header header;
+    struct iovec iov[2];
+
+    header = *request;
+    header.length = len;
+    header.status = status;
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = len;
+    send_iov(client, iov, len ? 2 : 1);
+}
+
+/*
+** Sends the rows of the session changed since generation (all of them
+** if all is set), returns the generation sent.
+*/
+static unsigned int send_screen(struct client *client,
+                                struct vt100d_header *header,
+                                struct session *session,
+                                unsigned int generation, int all)
+{
+    struct iovec iov[2 + 2 * 80];
+    struct vt100d_screen screen;
+    struct lw_terminal_vt100 *vt100;
+    const char **lines;
+    unsigned int y;
+    int iovcnt;
+
+    vt100 = session->vt100->term;
+    lines = lw_terminal_vt100_getlines(vt100);
+    memset(&screen, 0, sizeof(screen));
+    screen.generation = vt100->generation;
+    screen.width = vt100->width;
+    screen.height = vt100->height;
+    screen.x = vt100->x;
+    screen.y = vt100->y;
+    iovcnt = 2;
+    for (y = 0; y < vt100->height; ++y)
+    {
+        if (!all && (int)(vt100->line_generation[y] - generation) <= 0)
+            continue ;
+        iov[iovcnt].iov_base = &row_numbers[y];
+        iov[iovcnt].iov_len = sizeof(row_numbers[y]);
+        iov[iovcnt + 1].iov_base = (void *)lines[y];
+        iov[iovcnt + 1].iov_len = vt100->width;
+        iovcnt += 2;
+        screen.rows += 1;
+    }
+    header->length = sizeof(screen)
+        + screen.rows * (sizeof(row_numbers[0]) + vt100->width);
+    header->status = 0;
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof(*header);
+    iov[1].iov_base = &screen;
+    iov[1].iov_len = sizeof(screen);
+    send_iov(client, iov, iovcnt);
+    return screen.generation;
+}
+
+static void notify(struct client *client, struct subscription *subscription)
+{
+    struct vt100d_header header;
+
+    if (client->dead || client->out_used > OUT_LIMIT)
+        return ;
+    lw_terminal_vt100_flush(subscription->session->vt100->term);
+    if (subscription->generation
+        == subscription->session->vt100->term->generation)
+        return ;
+    header.opcode = VT100D_UPDATE;
+    header.session = subscription->session->id;
+    header.tag = 0;
+    subscription->generation = send_screen(client, &header,
+                                           subscription->session,
+                                           subscription->generation, 0);
+}
+
+static void session_changed(struct session *session)
+{
+    struct subscription *subscription;
+    struct client *client;
+
+    for (client = clients; client != NULL; client = client->next)
+        for (subscription = client->subscriptions; subscription != NULL;
+             subscription = subscription->next)
+            if (subscription->session == session)
+                notify(client, subscription);
+}
+
+static struct session *find_session(unsigned int id)
+{
+    struct session *session;
+
+    for (session = sessions; session != NULL; session = session->next)
+        if (session->id == id)
+            return session;
+    return NULL;
+}
+
+static int unsubscribe(struct client *client, struct session *session)
+{
+    struct subscription **link;
+    struct subscription *subscription;
+
+    for (link = &client->subscriptions; *link != NULL; link = &(*link)->next)
+        if ((*link)->session == session)
+        {
+            subscription = *link;
+            *link = subscription->next;
+            free(subscription);
+            return 0;
+        }
+    return -1;
+}
+
+static void end_session(struct session *session)
+{
+    struct vt100d_header header;
+    struct subscription *subscription;
+    struct session **link;
+    struct client *client;
+    unsigned int status;
+
+    status = session->vt100->exit_status;
+    for (client = clients; client != NULL; client = client->next)
+    {
+        for (subscription = client->subscriptions; subscription != NULL;
+             subscription = subscription->next)
+            if (subscription->session == session)
+                break ;
+        if (subscription == NULL)
+            continue ;
+        header.opcode = VT100D_UPDATE;
+        header.session = session->id;
+        header.tag = 0;
+        /* The last screen is sent even to clients lagging behind */
+        lw_terminal_vt100_flush(session->vt100->term);
+        if (subscription->generation != session->vt100->term->generation)
+            send_screen(client, &header, session, subscription->generation, 0);
+        unsubscribe(client, session);
+        header.opcode = VT100D_EXIT;
+        reply(client, &header, 0, &status, sizeof(status));
+    }
+    for (link = &sessions; *link != session; link = &(*link)->next)
+        ;
+    *link = session->next;
+    delete_vt100_headless(session->vt100);
+    free(session);
+}
+
+static void spawn(struct client *client, struct vt100d_header *header,
+                  char *payload)
+{
+    struct vt100_headless *vt100;
+    struct session *session;
+    unsigned short size[2];
+    char **argv;
+    size_t argc;
+    size_t i;
+
+    if (header->length < sizeof(size) + 1
+        || payload[header->length - 1] != '\0')
+    {
+        reply(client, header, EINVAL, NULL, 0);
+        return ;
+    }
+    errno = 0;
+    memcpy(size, payload, sizeof(size));
+    for (argc = 0, i = sizeof(size); i < header->length; ++i)
+        argc += payload[i] == '\0';
+    argv = calloc(argc + 1, sizeof(*argv));
+    session = calloc(1, sizeof(*session));
+    vt100 = new_vt100_headless();
+    if (argv == NULL || session == NULL || vt100 == NULL)
+        goto fail;
+    for (argc = 0, i = sizeof(size); i < header->length;
+         i += strlen(payload + i) + 1)
+        argv[argc++] = payload + i;
+    if ((size[0] || size[1])
+        && lw_terminal_vt100_resize(vt100->term, size[0], size[1]) == -1)
+    {
+        errno = EINVAL;
+        goto fail;
+    }
+    vt100->detached = 1;
+    vt100->hibernate_after_usec = hibernate_after_usec;
+    lw_terminal_vt100_lazy(vt100->term, lazy_budget);
+    if (vt100_headless_spawn(vt100, argv[0], argv) == -1)
+        goto fail;
+    /* A program not reading its input must not block WRITE, nor us */
+    fcntl(vt100->master, F_SETFL,
+          fcntl(vt100->master, F_GETFL) | O_NONBLOCK);
+    vt100->nonblocking = 1;
+    free(argv);
+    session->vt100 = vt100;
+    session->id = next_session++;
+    session->next = sessions;
+    sessions = session;
+    header->session = session->id;
+    reply(client, header, 0, NULL, 0);
+    return ;
+fail:
+    reply(client, header, errno ? errno : ENOMEM, NULL, 0);
+    if (vt100 != NULL)
+        delete_vt100_headless(vt100);
+    free(session);
+    free(argv);
+}
+
+static void subscribe(struct client *client, struct vt100d_header *header,
+                      struct session *session, unsigned int generation)
+{
+    struct subscription *subscription;
+
+    unsubscribe(client, session);
+    subscription = calloc(1, sizeof(*subscription));
+    if (subscription == NULL)
+    {
+        reply(client, header, ENOMEM, NULL, 0);
+        return ;
+    }
+    subscription->session = session;
+    subscription->generation = generation;
+    subscription->next = client->subscriptions;
+    client->subscriptions = subscription;
+    reply(client, header, 0, NULL, 0);
+    notify(client, subscription);
+}
+
+static void handle(struct client *client, struct vt100d_header *header,
+                   char *payload)
+{
+    struct session *session;
+    unsigned short size[2];
+    unsigned int value;
+    ssize_t written;
+
+    if (header->opcode == VT100D_SPAWN)
+    {
+        spawn(client, header, payload);
+        return ;
+    }
+    session = find_session(header->session);
+    if (session == NULL)
+    {
+        reply(client, header, ESRCH, NULL, 0);
+        return ;
+    }
+    value = 0;
+    if (header->length >= sizeof(value))
+        memcpy(&value, payload, sizeof(value));
+    switch (header->opcode)
+    {
+    case VT100D_WRITE:
+        written = vt100_headless_write(session->vt100, payload,
+                                       header->length);
+        if (written == -1)
+            reply(client, header, errno, NULL, 0);
+        else
+            reply(client, header,
+                  (size_t)written < header->length ? EAGAIN : 0, NULL, 0);
+        break ;
+    case VT100D_RESIZE:
+        memcpy(size, &value, sizeof(size));
+        if (header->length < sizeof(size)
+            || vt100_headless_resize(session->vt100, size[0], size[1]) == -1)
+            reply(client, header, EINVAL, NULL, 0);
+        else
+        {
+            reply(client, header, 0, NULL, 0);
+            session_changed(session);
+        }
+        break ;
+    case VT100D_SNAPSHOT:
+        send_screen(client, header, session, 0, 1);
+        break ;
+    case VT100D_DAMAGE:
+        send_screen(client, header, session, value, 0);
+        break ;
+    case VT100D_SUBSCRIBE:
+        subscribe(client, header, session, value);
+        break ;
+    case VT100D_UNSUBSCRIBE:
+        reply(client, header,
+              unsubscribe(client, session) == -1 ? ENOENT : 0, NULL, 0);
+        break ;
+    case VT100D_KILL:
+        reply(client, header, kill(session->vt100->child, value) == -1
+              ? errno : 0, NULL, 0);
+        break ;
+    default:
+        reply(client, header, EINVAL, NULL, 0);
+    }
+}
+
+static void read_client(struct client *client)
+{
+    struct vt100d_header header;
+    ssize_t read_size;
+    size_t used;
+
+    if (reserve(&client->in, &client->in_size, client->in_used + 65536) == -1)
+    {
+        client->dead = 1;
+        return ;
+    }
+    read_size = read(client->fd, client->in + client->in_used, 65536);
+    if (read_size <= 0)
+    {
+        if (read_size == 0 || (errno != EINTR && errno != EAGAIN))
+            client->dead = 1;
+        return ;
+    }
+    client->in_used += read_size;
+    used = 0;
+    while (!client->dead && client->in_used - used >= sizeof(header))
+    {
+        memcpy(&header, client->in + used, sizeof(header));
+        if (header.length > VT100D_MAX_PAYLOAD)
+        {
+            client->dead = 1;
+            return ;
+        }
+        if (client->in_used - used < sizeof(header) + header.length)
+            break ;
+        used += sizeof(header) + header.length;
+        handle(client, &header, client->in + used - header.length);
+    }
+    memmove(client->in, client->in + used, client->in_used - used);
+    client->in_used -= used;
+}
+
+static void flush_client(struct client *client)
+{
+    struct subscription *subscription;
+    ssize_t sent;
+
+    sent = send(client->fd, client->out, client->out_used,
+                MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent == -1)
+    {
+        if (errno != EAGAIN && errno != EINTR)
+            client->dead = 1;
+        return ;
+    }
+    memmove(client->out, client->out + sent, client->out_used - sent);
+    client->out_used -= sent;
+    /* Catch up with the updates held back */
+    for (subscription = client->subscriptions; subscription != NULL;
+         subscription = subscription->next)
+        notify(client, subscription);
+}
+
+static void accept_clients(int listener)
+{
+    struct client *client;
+    int fd;
+
+    while ((fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC)) != -1)
+    {
+        client = calloc(1, sizeof(*client));
+        if (client == NULL)
+        {
+            close(fd);
+            continue ;
+        }
+        client->fd = fd;
+        client->next = clients;
+        clients = client;
+    }
+}
+
+static void remove_dead_clients(void)
+{
+    struct client **link;
+    struct client *client;
+
+    link = &clients;
+    while (*link != NULL)
+    {
+        client = *link;
+        if (!client->dead)
+        {
+            link = &client->next;
+            continue ;
+        }
+        *link = client->next;
+        while (client->subscriptions != NULL)
+            unsubscribe(client, client->subscriptions->session);
+        close(client->fd);
+        free(client->in);
+        free(client->out);
+        free(client);
+    }
+}
+
+static void remove_ended_sessions(void)
+{
+    struct session *session;
+    struct session *next;
+
+    for (session = sessions; session != NULL; session = next)
+    {
+        next = session->next;
+        if (session->vt100->master_closed && session->vt100->child_exited)
+            end_session(session);
+    }
+}
+
+static void hibernate_idle_sessions(void)
+{
+    struct session *session;
+
+    for (session = sessions; session != NULL; session = session->next)
+        vt100_headless_hibernate_idle(session->vt100);
+}
+
+static int listen_on(const char *path)
+{
+    struct sockaddr_un addr;
+    int listener;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (listener == -1)
+        return -1;
+    unlink(path);
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == -1
+        || listen(listener, 128) == -1)
+    {
+        close(listener);
+        return -1;
+    }
+    return listener;
+}
+
+static size_t watch_all(int listener, struct pollfd **fds,
+                        struct watch **watches, size_t *size)
+{
+    struct session *session;
+    struct client *client;
+    size_t needed;
+    size_t n;
+
+    needed = 1;
+    for (client = clients; client != NULL; client = client->next)
+        needed += 1;
+    for (session = sessions; session != NULL; session = session->next)
+        needed += 2;
+    if (needed > *size)
+    {
+        free(*fds);
+        free(*watches);
+        *fds = calloc(needed * 2, sizeof(**fds));
+        *watches = calloc(needed * 2, sizeof(**watches));
+        if (*fds == NULL || *watches == NULL)
+            return 0;
+        *size = needed * 2;
+    }
+    (*fds)[0].fd = listener;
+    (*fds)[0].events = POLLIN;
+    (*watches)[0].client = NULL;
+    (*watches)[0].session = NULL;
+    n = 1;
+    for (client = clients; client != NULL; client = client->next, ++n)
+    {
+        (*fds)[n].fd = client->fd;
+        (*fds)[n].events = client->out_used ? POLLIN | POLLOUT : POLLIN;
+        (*watches)[n].client = client;
+        (*watches)[n].session = NULL;
+    }
+    for (session = sessions; session != NULL; session = session->next)
+    {
+        if (!session->vt100->master_closed)
+        {
+            (*fds)[n].fd = session->vt100->master;
+            (*fds)[n].events = POLLIN;
+            (*watches)[n].client = NULL;
+            (*watches)[n++].session = session;
+        }
+        if (session->vt100->pidfd != -1 && !session->vt100->child_exited)
+        {
+            (*fds)[n].fd = session->vt100->pidfd;
+            (*fds)[n].events = POLLIN;
+            (*watches)[n].client = NULL;
+            (*watches)[n++].session = session;
+        }
+    }
+    return n;
+}
+
+static void serve_session(struct session *session, int fd)
+{
+    struct vt100_headless *vt100;
+
+    vt100 = session->vt100;
+    if (fd != vt100->pidfd)
+    {
+        if (vt100_headless_pump(vt100) > 0)
+            session_changed(session);
+        return ;
+    }
+    if (!vt100_headless_reap(vt100, 0))
+        return ;
+    /*
+    ** Drain what the child left and stop there, a grandchild holding
+    ** the terminal must not keep the session alive.
+    */
+    while (vt100_headless_pump(vt100) > 0)
+        session_changed(session);
+    vt100->master_closed = 1;
+}
+
+int main(int ac, char **av)
+{
+    struct pollfd *fds;
+    struct watch *watches;
+    size_t size;
+    size_t nfds;
+    size_t i;
+    int listener;
+    int opt;
+
+    while ((opt = getopt(ac, av, "m:i:l:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'i':
+            hibernate_after_usec = strtoul(optarg, NULL, 10) * 1000000UL;
+            break ;
+        case 'l':
+            lazy_budget = strtoul(optarg, NULL, 10) * 1024;
+            break ;
+        case 'm':
+            if (vt100_metrics_serve(optarg) == -1)
+            {
+                perror(optarg);
+                return EXIT_FAILURE;
+            }
+            break ;
+        default: goto usage;
+        }
+    }
+    if (optind != ac - 1)
+        goto usage;
+    listener = listen_on(av[optind]);
+    if (listener == -1)
+    {
+        perror(av[optind]);
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < sizeof(row_numbers) / sizeof(row_numbers[0]); ++i)
+        row_numbers[i] = i;
+    fds = NULL;
+    watches = NULL;
+    size = 0;
+    for (;;)
+    {
+        nfds = watch_all(listener, &fds, &watches, &size);
+        if (nfds == 0)
+            return EXIT_FAILURE;
+        if (poll(fds, nfds, hibernate_after_usec ? 1000 : -1) == -1)
+        {
+            if (errno == EINTR)
+                continue ;
+            perror("poll()");
+            return EXIT_FAILURE;
+        }
+        for (i = 0; i < nfds; ++i)
+        {
+            if (fds[i].revents == 0)
+                continue ;
+            if (watches[i].client != NULL)
+            {
+                if (fds[i].revents & POLLOUT)
+                    flush_client(watches[i].client);
+                if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+                    read_client(watches[i].client);
+            }
+            else if (watches[i].session != NULL)
+                serve_session(watches[i].session, fds[i].fd);
+            else
+                accept_clients(listener);
+        }
+        for (i = 0; i < nfds; ++i)
+            if (watches[i].session != NULL
+                && watches[i].session->vt100->master_closed
+                && watches[i].session->vt100->pidfd == -1)
+                vt100_headless_reap(watches[i].session->vt100, 1);
+        remove_ended_sessions();
+        remove_dead_clients();
+        if (hibernate_after_usec)
+            hibernate_idle_sessions();
+    }
+usage:
+    fprintf(stderr, "Usage: %s [-m METRICS_SOCKET] [-i IDLE_SECONDS]"
+            " [-l LAZY_KB] SOCKET\n", av[0]);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __VT100D_H__
+#define __VT100D_H__
+
+/*
+** Protocol of vt100d, the session server.
+**
+** Messages go both ways on a local stream socket, so integers are in
+** the host's byte order. Every message is a vt100d_header followed by
+** length bytes of payload. A reply carries the opcode, session and tag
+** of its request, so clients may pipeline requests, and a status of 0
+** or an errno value.
+**
+** Requests and their payloads:
+**
+**     SPAWN        u16 width, u16 height, then the argv of the program
+**                  as NUL terminated strings. The reply carries the new
+**                  session.
+**     WRITE        Bytes to send to the program, as if typed.
+**     RESIZE       u16 width, u16 height.
+**     SNAPSHOT     Nothing. Replied with a screen listing every row.
+**     DAMAGE       u32 generation. Replied with a screen listing the
+**                  rows changed since that generation.
+**     SUBSCRIBE    u32 generation. The session then pushes UPDATE
+**                  messages (tag 0), whose payload is a screen listing
+**                  the rows changed since the previous one, and an
+**                  EXIT message (u32 wait status) when the program
+**                  ends.
+**     UNSUBSCRIBE  Nothing.
+**     KILL         u32 signal number.
+**
+** A screen is a vt100d_screen followed by rows entries, each made of a
+** u16 row number and width bytes of text.
+**
+** Updates to a subscriber that does not read fast enough are held
+** back and merged, never queued without bound.
+*/
+
+#define VT100D_SPAWN       1
+#define VT100D_WRITE       2
+#define VT100D_RESIZE      3
+#define VT100D_SNAPSHOT    4
+#define VT100D_DAMAGE      5
+#define VT100D_SUBSCRIBE   6
+#define VT100D_UNSUBSCRIBE 7
+#define VT100D_KILL        8
+#define VT100D_UPDATE      16
+#define VT100D_EXIT        17
+
+#define VT100D_MAX_PAYLOAD (1024 * 1024)
+
+struct vt100d_header
+{
+    unsigned int   length;
+    unsigned short opcode;
+    unsigned short status;
+    unsigned int   session;
+    unsigned int   tag;
+};
+
+struct vt100d_screen
+{
+    unsigned int   generation;
+    unsigned short width;
+    unsigned short height;
+    unsigned short x;
+    unsigned short y;
+    unsigned short rows;
+    unsigned short reserved;
+};
+
+#endif
@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2016 Julien Palard.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "vt100d.h"
+
+/*
+** Measures vt100d round trips.
+**
+** Usage: vt100d_bench [-c CLIENTS] [-n REQUESTS]
+**                     [-o snapshot|damage|write] SOCKET
+**
+** Spawns a cat session, then CLIENTS threads, each with its own
+** connection, send it REQUESTS requests one after the other, waiting
+** for each reply. Prints the requests per second of all the clients
+** together and the distribution of the round trips.
+*/
+
+struct client
+{
+    pthread_t    thread;
+    const char   *path;
+    unsigned int session;
+    int          opcode;
+    double       *latencies;
+    int          failed;
+};
+
+static unsigned long requests = 10000;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int connect_to(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int read_full(int fd, void *buffer, size_t len)
+{
+    ssize_t read_size;
+    size_t done;
+
+    for (done = 0; done < len; done += read_size)
+    {
+        read_size = read(fd, (char *)buffer + done, len - done);
+        if (read_size <= 0)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+** Sends a request and waits for its reply, skipping pushed messages.
+** The reply's payload is left in buffer. Returns its status, or -1.
+*/
+static int call(int fd, struct vt100d_header *request, const void *payload,
+                char *buffer, size_t size)
+{
+    struct vt100d_header header;
+    char message[sizeof(header) + 256];
+
+    memcpy(message, request, sizeof(*request));
+    memcpy(message + sizeof(*request), payload, request->length);
+    if (write(fd, message, sizeof(*request) + request->length)
+        != (ssize_t)(sizeof(*request) + request->length))
+        return -1;
+    do
+    {
+        if (read_full(fd, &header, sizeof(header)) == -1
+            || header.length > size
+            || read_full(fd, buffer, header.length) == -1)
+            return -1;
+    } while (header.tag != request->tag || header.opcode != request->opcode);
+    request->session = header.session;
+    return header.status;
+}
+
+static void *run(void *data)
+{
+    struct vt100d_header request;
+    struct vt100d_screen screen;
+    struct client *client;
+    unsigned int generation;
+    unsigned long i;
+    char *buffer;
+    double start;
+    int fd;
+
+    client = data;
+    buffer = malloc(VT100D_MAX_PAYLOAD);
+    fd = connect_to(client->path);
+    if (fd == -1 || buffer == NULL)
+    {
+        client->failed = 1;
+        return NULL;
+    }
+    generation = 0;
+    for (i = 0; i < requests; ++i)
+    {
+        request.opcode = client->opcode;
+        request.status = 0;
+        request.session = client->session;
+        request.tag = i + 1;
+        request.length = client->opcode == VT100D_SNAPSHOT ? 0
+            : client->opcode == VT100D_DAMAGE ? sizeof(generation) : 1;
+        start = now();
+        if (call(fd, &request, client->opcode == VT100D_WRITE
+                 ? (void *)"x" : (void *)&generation, buffer,
+                 VT100D_MAX_PAYLOAD) != 0)
+        {
+            client->failed = 1;
+            break ;
+        }
+        client->latencies[i] = now() - start;
+        if (client->opcode == VT100D_DAMAGE)
+        {
+            memcpy(&screen, buffer, sizeof(screen));
+            generation = screen.generation;
+        }
+    }
+    close(fd);
+    free(buffer);
+    return NULL;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x;
+    double y;
+
+    x = *(const double *)a;
+    y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int ac, char **av)
+{
+    static const unsigned short size[2] = {80, 24};
+    struct vt100d_header request;
+    struct client *clients;
+    unsigned long nclients;
+    unsigned long i;
+    double *latencies;
+    double seconds;
+    char buffer[256];
+    char spawn[sizeof(size) + sizeof("cat")];
+    unsigned int signal_number;
+    int opcode;
+    int opt;
+    int fd;
+
+    nclients = 16;
+    opcode = VT100D_SNAPSHOT;
+    while ((opt = getopt(ac, av, "c:n:o:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c': nclients = strtoul(optarg, NULL, 10); break ;
+        case 'n': requests = strtoul(optarg, NULL, 10); break ;
+        case 'o':
+            if (strcmp(optarg, "snapshot") == 0)
+                opcode = VT100D_SNAPSHOT;
+            else if (strcmp(optarg, "damage") == 0)
+                opcode = VT100D_DAMAGE;
+            else if (strcmp(optarg, "write") == 0)
+                opcode = VT100D_WRITE;
+            else
+                goto usage;
+            break ;
+        default: goto usage;
+        }
+    }
+    if (optind != ac - 1 || nclients == 0 || requests == 0)
+        goto usage;
+    fd = connect_to(av[optind]);
+    if (fd == -1)
+    {
+        perror(av[optind]);
+        return EXIT_FAILURE;
+    }
+    memcpy(spawn, size, sizeof(size));
+    memcpy(spawn + sizeof(size), "cat", sizeof("cat"));
+    memset(&request, 0, sizeof(request));
+    request.opcode = VT100D_SPAWN;
+    request.length = sizeof(spawn);
+    if (call(fd, &request, spawn, buffer, sizeof(buffer)) != 0)
+    {
+        fprintf(stderr, "spawn failed\n");
+        return EXIT_FAILURE;
+    }
+    clients = calloc(nclients, sizeof(*clients));
+    latencies = calloc(nclients * requests, sizeof(*latencies));
+    if (clients == NULL || latencies == NULL)
+        return EXIT_FAILURE;
+    seconds = now();
+    for (i = 0; i < nclients; ++i)
+    {
+        clients[i].path = av[optind];
+        clients[i].session = request.session;
+        clients[i].opcode = opcode;
+        clients[i].latencies = latencies + i * requests;
+        if (pthread_create(&clients[i].thread, NULL, run, &clients[i]) != 0)
+            return EXIT_FAILURE;
+    }
+    for (i = 0; i < nclients; ++i)
+    {
+        pthread_join(clients[i].thread, NULL);
+        if (clients[i].failed)
+            fprintf(stderr, "client %lu failed\n", i);
+    }
+    seconds = now() - seconds;
+    request.opcode = VT100D_KILL;
+    request.length = sizeof(signal_number);
+    signal_number = SIGKILL;
+    call(fd, &request, &signal_number, buffer, sizeof(buffer));
+    close(fd);
+    qsort(latencies, nclients * requests, sizeof(*latencies),
+          compare_doubles);
+    i = nclients * requests;
+    printf("%lu clients, %lu requests, %.3fs, %.0f requests/s\n",
+           nclients, i, seconds, i / seconds);
+    printf("round trip us: p50 %.1f p90 %.1f p99 %.1f max %.1f\n",
+           latencies[i / 2] * 1e6, latencies[i * 9 / 10] * 1e6,
+           latencies[i * 99 / 100] * 1e6, latencies[i - 1] * 1e6);
+    return EXIT_SUCCESS;
+usage:
+    fprintf(stderr, "Usage: %s [-c CLIENTS] [-n REQUESTS]"
+            " [-o snapshot|damage|write] SOCKET\n", av[0]);
+    return EXIT_FAILURE;
+}